@@ -1,4 +1,32 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <new>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BNL_VECTOR_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define BNL_TARGET_AVX2
+#else
+#define BNL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
 
 #include "../CppUtils/disc_union.h"
 #include "../CppUtils/strings.h"
@@ -6,8 +34,10 @@
 
 struct LispValue;
 struct LispBinding;
+struct LispEvalContext;
+struct LispPromiseCell;
 
-typedef void (BuiltinFuncOp)(LispValue*, int, LispValue*);
+typedef void (BuiltinFuncOp)(LispValue*, int, LispValue*, LispEvalContext*);
 
 struct LispLambdaValue {
 	Vector<SubString> argNames;
@@ -57,8 +87,136 @@ struct LispVoidValue {
 
 };
 
-struct LispPairValue {
-	Vector<LispValue> vals;
+struct LispPendingFree {
+	void* cell;
+	void (*freeFunc)(void*);
+};
+
+// Freeing one cell can release the last reference to the next (a cons-built list's tail, a forced
+// stream's value), so long chains would recurse once per link. Cells released while another one is
+// being freed are queued here instead, and the outermost FreeLispCell frees them in a loop.
+Vector<LispPendingFree> pendingCellFrees;
+bool isFreeingCells = false;
+
+void FreeLispCell(void* cell, void (*freeFunc)(void*)) {
+	if (isFreeingCells) {
+		LispPendingFree pending;
+		pending.cell = cell;
+		pending.freeFunc = freeFunc;
+		pendingCellFrees.PushBack(pending);
+		return;
+	}
+
+	isFreeingCells = true;
+	freeFunc(cell);
+	while (pendingCellFrees.count > 0) {
+		LispPendingFree next = pendingCellFrees.Back();
+		pendingCellFrees.PopBack();
+		next.freeFunc(next.cell);
+	}
+	isFreeingCells = false;
+}
+
+template<typename T>
+void DeleteLispCell(void* cell) {
+	delete (T*)cell;
+}
+
+// Releases one reference to a cell, deleting it when there are none left.
+// Cells that need more than delete to free them (list chunks) overload this.
+template<typename T>
+void ReleaseLispCell(T* cell) {
+	cell->refCount--;
+	if (cell->refCount == 0) {
+		FreeLispCell(cell, DeleteLispCell<T>);
+	}
+}
+
+// A counted reference to a cell that is shared between copies of a value.
+// Cells start with a refCount of 0 and are freed when the last reference goes away.
+template<typename T>
+struct LispCellRef {
+	T* cell;
+
+	LispCellRef(T* _cell = nullptr) {
+		cell = _cell;
+		if (cell != nullptr) {
+			cell->refCount++;
+		}
+	}
+
+	LispCellRef(const LispCellRef& orig) {
+		cell = orig.cell;
+		if (cell != nullptr) {
+			cell->refCount++;
+		}
+	}
+
+	LispCellRef& operator=(const LispCellRef& orig) {
+		if (orig.cell != nullptr) {
+			orig.cell->refCount++;
+		}
+
+		T* prevCell = cell;
+		cell = orig.cell;
+
+		if (prevCell != nullptr) {
+			ReleaseLispCell(prevCell);
+		}
+
+		return *this;
+	}
+
+	~LispCellRef() {
+		if (cell != nullptr) {
+			ReleaseLispCell(cell);
+		}
+	}
+};
+
+struct LispListChunk;
+
+void ReleaseLispCell(LispListChunk* chunk);
+
+// Lists are cdr-coded: a chunk stores a run of elements contiguously, followed by
+// the tail of the last one. A pair is a view into a chunk, so cdr just bumps the offset.
+// Chunks are never mutated once built, so copies can share them.
+struct LispPairValue : LispCellRef<LispListChunk> {
+	int offset;
+
+	LispPairValue();
+	LispPairValue(LispListChunk* _chunk, int _offset);
+
+	const LispValue& Car() const;
+	void Cdr(LispValue* outVal) const;
+};
+
+// A memoized, lazily-evaluated value (from delay/stream-cons).
+// Copies share the same cell, so forcing any copy forces them all.
+struct LispPromiseValue : LispCellRef<LispPromiseCell> {
+	LispPromiseValue();
+};
+
+struct LispPortCell;
+
+// An open file, from open-input/open-output. Closed when the last copy goes away.
+struct LispPortValue : LispCellRef<LispPortCell> {
+	LispPortValue(LispPortCell* _cell) : LispCellRef<LispPortCell>(_cell) { }
+};
+
+struct LispMemoCell;
+
+// A function defined with define-memo: a lambda plus an LRU cache of its results, keyed on the argument values
+struct LispMemoValue : LispCellRef<LispMemoCell> {
+	LispMemoValue(LispMemoCell* _cell) : LispCellRef<LispMemoCell>(_cell) { }
+};
+
+struct LispVectorData;
+
+// A packed, homogeneous numeric vector (make-f64vector/make-i64vector).
+// Copies share the same storage, so vector-set! is visible through all of them.
+struct LispVectorValue : LispCellRef<LispVectorData> {
+	LispVectorValue(LispVectorData* _data) : LispCellRef<LispVectorData>(_data) { }
 };
 
 #define DISC_MAC(mac)    \
@@ -70,92 +228,1380 @@ struct LispPairValue {
 	mac(LispStringValue) \
 	mac(LispSymbolValue) \
 	mac(LispBoolValue) \
-	mac(LispPairValue)
+	mac(LispPairValue) \
+	mac(LispPromiseValue) \
+	mac(LispPortValue) \
+	mac(LispVectorValue) \
+	mac(LispMemoValue)
+
+DEFINE_DISCRIMINATED_UNION(LispValue, DISC_MAC)
+
+#undef DISC_MAC
+
+// Bytes currently held by list chunks, promises, vectors, port buffers and memo caches, for LispEvalLimits::maxDataBytes.
+// Closures and strings aren't counted.
+long long lispDataBytes = 0;
+
+// Incremented for each port created. Ones made before LispEvalContext::sealedSerial (the --serve prelude)
+// share their file offset with every request's forked copy, so requests can't use them.
+long long lispObjectSerial = 0;
+
+struct LispPromiseCell {
+	int refCount;
+	bool isForced;
+	LispValue value;
+
+	// Either a Lisp expression and its captured bindings (from delay)...
+	BNSexpr body;
+	Vector<LispBinding> closureBindings;
+
+	// ...or a native thunk applied to thunkArgs (from the stream builtins)
+	BuiltinFuncOp* thunk;
+	Vector<LispValue> thunkArgs;
+
+	LispPromiseCell() {
+		refCount = 0;
+		isForced = false;
+		thunk = nullptr;
+		lispDataBytes += sizeof(LispPromiseCell);
+	}
+
+	~LispPromiseCell() {
+		lispDataBytes -= sizeof(LispPromiseCell);
+	}
+};
+
+LispPromiseValue::LispPromiseValue() : LispCellRef<LispPromiseCell>(new LispPromiseCell()) {
+}
+
+// The header and values of a chunk share one allocation, so walking a list
+// goes straight from one element to the next without an extra pointer hop.
+struct alignas(LispValue) LispListChunk {
+	int refCount;
+	// Elements, then the final tail (usually #f)
+	int count;
+	int byteCount;
+
+	LispValue* Values() {
+		return (LispValue*)(this + 1);
+	}
+
+	// The caller constructs all count values in place
+	static LispListChunk* Allocate(int elemCount) {
+		int byteCount = sizeof(LispListChunk) + (elemCount + 1) * sizeof(LispValue);
+		LispListChunk* chunk = (LispListChunk*)malloc(byteCount);
+		chunk->refCount = 0;
+		chunk->count = elemCount + 1;
+		chunk->byteCount = byteCount;
+		lispDataBytes += byteCount;
+		return chunk;
+	}
+};
+
+void FreeLispListChunk(void* cell) {
+	LispListChunk* chunk = (LispListChunk*)cell;
+	LispValue* values = chunk->Values();
+	for (int i = 0; i < chunk->count; i++) {
+		values[i].~LispValue();
+	}
+
+	lispDataBytes -= chunk->byteCount;
+	free(chunk);
+}
+
+void ReleaseLispCell(LispListChunk* chunk) {
+	chunk->refCount--;
+	if (chunk->refCount == 0) {
+		FreeLispCell(chunk, FreeLispListChunk);
+	}
+}
+
+LispPairValue::LispPairValue() {
+	offset = 0;
+}
+
+LispPairValue::LispPairValue(LispListChunk* _chunk, int _offset) : LispCellRef<LispListChunk>(_chunk) {
+	ASSERT(_offset + 1 < _chunk->count);
+	offset = _offset;
+}
+
+const LispValue& LispPairValue::Car() const {
+	return cell->Values()[offset];
+}
+
+void LispPairValue::Cdr(LispValue* outVal) const {
+	// Build the result before assigning, since outVal may be the pair holding our chunk
+	LispValue next;
+	if (offset + 2 == cell->count) {
+		next = cell->Values()[offset + 1];
+	}
+	else {
+		next = LispPairValue(cell, offset + 1);
+	}
+
+	*outVal = next;
+}
+
+// Moves a list cursor on to its cdr. Within a chunk that just bumps the offset in place,
+// so walking a chunked list doesn't touch any refcounts.
+void AdvanceLispList(LispValue* cursor) {
+	LispPairValue& pair = cursor->AsLispPairValue();
+	if (pair.offset + 2 < pair.cell->count) {
+		pair.offset++;
+	}
+	else {
+		pair.Cdr(cursor);
+	}
+}
+
+// Builds the list (vals[0] ... vals[count-1] . tail) as a single chunk
+void MakeLispList(const LispValue* vals, int count, const LispValue& tail, LispValue* outVal) {
+	if (count == 0) {
+		*outVal = tail;
+		return;
+	}
+
+	LispListChunk* chunk = LispListChunk::Allocate(count);
+	LispValue* values = chunk->Values();
+	for (int i = 0; i < count; i++) {
+		new (&values[i]) LispValue(vals[i]);
+	}
+	new (&values[count]) LispValue(tail);
+
+	*outVal = LispPairValue(chunk, 0);
+}
+
+void LispValuesToList(const LispValue* vals, int count, LispValue* outVal) {
+	LispValue end;
+	end = LispBoolValue(false);
+	MakeLispList(vals, count, end, outVal);
+}
+
+static const int portBufferSize = 1024 * 1024;
+// Largest read-chunk request, which keeps buffer sizes well inside an int
+static const int maxReadChunkSize = 256 * 1024 * 1024;
+
+struct LispPortCell {
+	int refCount;
+	long long serial;
+	FILE* file;
+	bool isInput;
+	bool isEOF;
+
+	// Input is read a large block at a time. Strings returned from the port are views
+	// into buffer, so refilling moves to a fresh buffer instead of overwriting this one.
+	String buffer;
+	int readPos;
+	int fillCount;
+	// Size of buffer (or of stdio's buffer, for output), as counted in lispDataBytes.
+	// A replaced buffer stops being counted even if a large read-chunk result still shares it.
+	int bufferSize;
+
+	LispPortCell(FILE* _file, bool _isInput) {
+		refCount = 0;
+		serial = lispObjectSerial++;
+		file = _file;
+		isInput = _isInput;
+		isEOF = false;
+		readPos = 0;
+		fillCount = 0;
+		bufferSize = 0;
+	}
+
+	void Close() {
+		if (file != nullptr && file != stdout) {
+			fclose(file);
+		}
+		file = nullptr;
+	}
+
+	~LispPortCell() {
+		Close();
+		lispDataBytes -= bufferSize;
+	}
+};
+
+struct LispVectorData {
+	int refCount;
+	bool isFloat;
+	int count;
+	// 32-byte aligned, with the same count elements in whichever one isFloat says
+	union {
+		double* fValues;
+		long long* iValues;
+		void* values;
+	};
+
+	LispVectorData(int _count, bool _isFloat) {
+		refCount = 0;
+		isFloat = _isFloat;
+		count = _count;
+		ASSERT(count >= 0);
+		values = AllocateAligned(BNS_MAX(ByteSize(count), (size_t)8));
+		memset(values, 0, ByteSize(count));
+		lispDataBytes += sizeof(LispVectorData) + ByteSize(count);
+	}
+
+	~LispVectorData() {
+		FreeAligned(values);
+		lispDataBytes -= sizeof(LispVectorData) + ByteSize(count);
+	}
+
+	static size_t ByteSize(int count) {
+		return (size_t)count * 8;
+	}
+
+	static void* AllocateAligned(size_t size) {
+#if defined(_MSC_VER)
+		return _aligned_malloc(size, 32);
+#else
+		void* ptr = nullptr;
+		int err = posix_memalign(&ptr, 32, size);
+		ASSERT(err == 0);
+		return ptr;
+#endif
+	}
+
+	static void FreeAligned(void* ptr) {
+#if defined(_MSC_VER)
+		_aligned_free(ptr);
+#else
+		free(ptr);
+#endif
+	}
+};
+
+static const int defaultMemoCapacity = 4096;
+
+struct LispMemoEntry {
+	Vector<LispValue> args;
+	LispValue result;
+	unsigned int hash;
+	int nextInBucket;
+	int lruPrev;
+	int lruNext;
+};
+
+struct LispMemoCell {
+	int refCount;
+	String name;
+	LispValue func;
+
+	// Entries live in a pool of at most capacity, chained into hash buckets
+	// and into an LRU list running from lruHead (most recent) to lruTail
+	Vector<LispMemoEntry> entries;
+	Vector<int> buckets;
+	int capacity;
+	int lruHead;
+	int lruTail;
+
+	long long hits;
+	long long misses;
+	long long evictions;
+
+	LispMemoCell(int _capacity) {
+		refCount = 0;
+		capacity = BNS_MAX(_capacity, 1);
+		lruHead = -1;
+		lruTail = -1;
+		hits = 0;
+		misses = 0;
+		evictions = 0;
+
+		int bucketCount = 16;
+		while (bucketCount < capacity * 2) {
+			bucketCount *= 2;
+		}
+
+		buckets.EnsureCapacity(bucketCount);
+		for (int i = 0; i < bucketCount; i++) {
+			buckets.PushBack(-1);
+		}
+
+		lispDataBytes += sizeof(LispMemoCell) + bucketCount * sizeof(int);
+	}
+
+	~LispMemoCell() {
+		lispDataBytes -= sizeof(LispMemoCell) + buckets.count * sizeof(int) + entries.count * sizeof(LispMemoEntry);
+	}
+};
+
+// FNV-1a
+unsigned int HashBytes(unsigned int hash, const void* bytes, int length) {
+	const unsigned char* ptr = (const unsigned char*)bytes;
+	for (int i = 0; i < length; i++) {
+		hash ^= ptr[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Mixes a structural hash of val into *hash. Returns false for values that can't be memo keys
+// (functions, promises, ports and vectors, which aren't compared by value, and NaN, which never equals itself).
+bool HashLispValue(const LispValue& val, unsigned int* hash) {
+	LispValue cursor = val;
+	while (cursor.IsLispPairValue()) {
+		*hash = HashBytes(*hash, "(", 1);
+		if (!HashLispValue(cursor.AsLispPairValue().Car(), hash)) {
+			return false;
+		}
+		AdvanceLispList(&cursor);
+	}
+
+	if (cursor.IsLispNumValue()) {
+		const LispNumValue& num = cursor.AsLispNumValue();
+		// NaN never equals itself, so a NaN key would never hit and just push out useful entries
+		if (num.isFloat && num.fValue != num.fValue) {
+			return false;
+		}
+
+		*hash = HashBytes(*hash, num.isFloat ? "f" : "i", 1);
+		if (num.isFloat) {
+			*hash = HashBytes(*hash, &num.fValue, sizeof(num.fValue));
+		}
+		else {
+			*hash = HashBytes(*hash, &num.iValue, sizeof(num.iValue));
+		}
+	}
+	else if (cursor.IsLispStringValue()) {
+		*hash = HashBytes(*hash, "\"", 1);
+		*hash = HashBytes(*hash, cursor.AsLispStringValue().value.start, cursor.AsLispStringValue().value.length);
+	}
+	else if (cursor.IsLispSymbolValue()) {
+		*hash = HashBytes(*hash, "`", 1);
+		*hash = HashBytes(*hash, cursor.AsLispSymbolValue().value.start, cursor.AsLispSymbolValue().value.length);
+	}
+	else if (cursor.IsLispBoolValue()) {
+		*hash = HashBytes(*hash, cursor.AsLispBoolValue().val ? "t" : "n", 1);
+	}
+	else if (cursor.IsLispVoidValue()) {
+		*hash = HashBytes(*hash, "v", 1);
+	}
+	else {
+		return false;
+	}
+
+	return true;
+}
+
+// Structural equality, for the value types HashLispValue accepts
+bool LispValuesEqual(const LispValue& a, const LispValue& b) {
+	// Walk along the lists, only recursing into their elements, so long lists don't use up the stack
+	LispValue aCursor = a;
+	LispValue bCursor = b;
+	while (aCursor.IsLispPairValue() && bCursor.IsLispPairValue()) {
+		if (!LispValuesEqual(aCursor.AsLispPairValue().Car(), bCursor.AsLispPairValue().Car())) {
+			return false;
+		}
+
+		AdvanceLispList(&aCursor);
+		AdvanceLispList(&bCursor);
+	}
+
+	if (aCursor.IsLispNumValue() && bCursor.IsLispNumValue()) {
+		const LispNumValue& aNum = aCursor.AsLispNumValue();
+		const LispNumValue& bNum = bCursor.AsLispNumValue();
+		if (aNum.isFloat != bNum.isFloat) {
+			return false;
+		}
+		return aNum.isFloat ? aNum.fValue == bNum.fValue : aNum.iValue == bNum.iValue;
+	}
+	else if (aCursor.IsLispStringValue() && bCursor.IsLispStringValue()) {
+		return aCursor.AsLispStringValue().value == bCursor.AsLispStringValue().value;
+	}
+	else if (aCursor.IsLispSymbolValue() && bCursor.IsLispSymbolValue()) {
+		return aCursor.AsLispSymbolValue().value == bCursor.AsLispSymbolValue().value;
+	}
+	else if (aCursor.IsLispBoolValue() && bCursor.IsLispBoolValue()) {
+		return aCursor.AsLispBoolValue().val == bCursor.AsLispBoolValue().val;
+	}
+	else if (aCursor.IsLispVoidValue() && bCursor.IsLispVoidValue()) {
+		return true;
+	}
+
+	return false;
+}
+
+void MemoUnlinkLRU(LispMemoCell* cell, int index) {
+	LispMemoEntry* entry = &cell->entries.data[index];
+	if (entry->lruPrev >= 0) {
+		cell->entries.data[entry->lruPrev].lruNext = entry->lruNext;
+	}
+	else {
+		cell->lruHead = entry->lruNext;
+	}
+
+	if (entry->lruNext >= 0) {
+		cell->entries.data[entry->lruNext].lruPrev = entry->lruPrev;
+	}
+	else {
+		cell->lruTail = entry->lruPrev;
+	}
+}
+
+void MemoPushLRU(LispMemoCell* cell, int index) {
+	LispMemoEntry* entry = &cell->entries.data[index];
+	entry->lruPrev = -1;
+	entry->lruNext = cell->lruHead;
+	if (cell->lruHead >= 0) {
+		cell->entries.data[cell->lruHead].lruPrev = index;
+	}
+	cell->lruHead = index;
+
+	if (cell->lruTail < 0) {
+		cell->lruTail = index;
+	}
+}
+
+int MemoLookup(LispMemoCell* cell, const LispValue* args, int argCount, unsigned int hash) {
+	int index = cell->buckets.data[hash & (cell->buckets.count - 1)];
+	while (index >= 0) {
+		LispMemoEntry* entry = &cell->entries.data[index];
+		if (entry->hash == hash && entry->args.count == argCount) {
+			bool isMatch = true;
+			for (int i = 0; i < argCount; i++) {
+				if (!LispValuesEqual(entry->args.data[i], args[i])) {
+					isMatch = false;
+					break;
+				}
+			}
+
+			if (isMatch) {
+				return index;
+			}
+		}
+
+		index = entry->nextInBucket;
+	}
+
+	return -1;
+}
+
+void MemoInsert(LispMemoCell* cell, const LispValue* args, int argCount, unsigned int hash, const LispValue& result) {
+	int index;
+	if (cell->entries.count < cell->capacity) {
+		index = cell->entries.count;
+		cell->entries.EmplaceBack();
+		lispDataBytes += sizeof(LispMemoEntry);
+	}
+	else {
+		// Reuse the least recently used entry, after taking it out of its bucket chain
+		index = cell->lruTail;
+		MemoUnlinkLRU(cell, index);
+
+		int* link = &cell->buckets.data[cell->entries.data[index].hash & (cell->buckets.count - 1)];
+		while (*link != index) {
+			link = &cell->entries.data[*link].nextInBucket;
+		}
+		*link = cell->entries.data[index].nextInBucket;
+
+		cell->evictions++;
+	}
+
+	LispMemoEntry* entry = &cell->entries.data[index];
+	entry->args.Clear();
+	for (int i = 0; i < argCount; i++) {
+		entry->args.PushBack(args[i]);
+	}
+	entry->result = result;
+	entry->hash = hash;
+
+	int* bucket = &cell->buckets.data[hash & (cell->buckets.count - 1)];
+	entry->nextInBucket = *bucket;
+	*bucket = index;
+
+	MemoPushLRU(cell, index);
+}
+
+// Makes sure at least minBytes are buffered past readPos (unless the file runs out).
+// Returns the number of bytes available.
+int EnsurePortBuffered(LispPortCell* port, int minBytes) {
+	int available = port->fillCount - port->readPos;
+	if (available >= minBytes || port->isEOF || port->file == nullptr) {
+		return available;
+	}
+
+	int newSize = BNS_MAX(portBufferSize, minBytes * 2);
+	String newBuffer;
+	newBuffer.SetSize(newSize);
+	memcpy(newBuffer.string, port->buffer.string + port->readPos, available);
+
+	int readCount = (int)fread(newBuffer.string + available, 1, newSize - available, port->file);
+	if (readCount < newSize - available) {
+		port->isEOF = true;
+	}
+
+	port->buffer = newBuffer;
+	lispDataBytes += newSize - port->bufferSize;
+	port->bufferSize = newSize;
+	port->readPos = 0;
+	port->fillCount = available + readCount;
+	return port->fillCount;
+}
+
+void ForceLispValue(LispValue* val, LispEvalContext* ctx);
+bool HasEvalError(LispEvalContext* ctx);
+bool CheckWritable(long long serial, LispEvalContext* ctx);
+bool CheckDataLimit(size_t newBytes, LispEvalContext* ctx);
+void ApplyLispFunc(LispValue* func, LispValue* args, int argCount, LispValue* outVal, LispEvalContext* ctx);
+
+void MakeNativePromise(BuiltinFuncOp* thunk, const LispValue* args, int argCount, LispValue* outVal) {
+	LispPromiseValue promise;
+	promise.cell->thunk = thunk;
+	promise.cell->thunkArgs.EnsureCapacity(argCount);
+	for (int i = 0; i < argCount; i++) {
+		promise.cell->thunkArgs.PushBack(args[i]);
+	}
+
+	*outVal = promise;
+}
+
+bool IsLispValueTruthy(const LispValue& val) {
+	return !(val.IsLispBoolValue() && !val.AsLispBoolValue().val);
+}
+
+#define MATH_BUILTIN_OP(name, op)                                                        \
+			void MathBuiltin_ ## name (LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {  \
+				ASSERT(count == 2);                                                      \
+				ASSERT(vals[0].IsLispNumValue());                                        \
+				ASSERT(vals[1].IsLispNumValue());                                        \
+				LispNumValue num = 0.0;                                                  \
+				if (vals[0].AsLispNumValue().isFloat || vals[1].AsLispNumValue().isFloat) {                  \
+					num = vals[0].AsLispNumValue().CoerceDouble() op vals[1].AsLispNumValue().CoerceDouble();\
+				}              \
+				else {         \
+					num = vals[0].AsLispNumValue().iValue op vals[1].AsLispNumValue().iValue;                \
+				}              \
+				*outVal = num; \
+			}
+
+MATH_BUILTIN_OP(Mul, *)
+MATH_BUILTIN_OP(Div, /)
+MATH_BUILTIN_OP(Add, +)
+MATH_BUILTIN_OP(Sub, -)
+
+void MathBuiltin_Equ(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 2);               
+	LispBoolValue res = false;
+	if (vals[0].IsLispNumValue() && vals[1].IsLispNumValue()) {
+		if (vals[0].AsLispNumValue().isFloat || vals[1].AsLispNumValue().isFloat) {
+			res = vals[0].AsLispNumValue().CoerceDouble() == vals[1].AsLispNumValue().CoerceDouble();
+		}
+		else {
+			res = vals[0].AsLispNumValue().iValue == vals[1].AsLispNumValue().iValue;
+		}
+	}
+	*outVal = res;
+}
+
+void StringBuiltin_cmp(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 2);
+	ASSERT(vals[0].IsLispStringValue());
+	ASSERT(vals[1].IsLispStringValue());
+	int len = BNS_MIN(vals[0].AsLispStringValue().value.length, vals[1].AsLispStringValue().value.length);
+	LispNumValue num = strncmp(vals[0].AsLispStringValue().value.start, vals[1].AsLispStringValue().value.start, len);
+	*outVal = num;
+}
+
+void Builtin_car(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 1);
+	ASSERT(vals[0].IsLispPairValue());
+	*outVal = vals[0].AsLispPairValue().Car();
+}
+
+void Builtin_cdr(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 1);
+	ASSERT(vals[0].IsLispPairValue());
+	vals[0].AsLispPairValue().Cdr(outVal);
+}
+
+void Builtin_cons(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 2);
+	MakeLispList(&vals[0], 1, vals[1], outVal);
+}
+
+void Builtin_isList(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 1);
+	LispBoolValue res = vals[0].IsLispPairValue();
+	*outVal = res;
+}
+
+void Builtin_SymbolEqual(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 2);
+	LispBoolValue res = false;
+	if (vals[0].IsLispSymbolValue() && vals[1].IsLispSymbolValue()) {
+		res = vals[0].AsLispSymbolValue().value == vals[1].AsLispSymbolValue().value;
+	}
+	*outVal = res;
+}
+
+void Builtin_force(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 1);
+	*outVal = vals[0];
+	ForceLispValue(outVal, ctx);
+}
+
+void Builtin_streamCar(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 1);
+	ASSERT(vals[0].IsLispPairValue());
+	*outVal = vals[0].AsLispPairValue().Car();
+}
+
+void Builtin_streamCdr(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 1);
+	ASSERT(vals[0].IsLispPairValue());
+	vals[0].AsLispPairValue().Cdr(outVal);
+	ForceLispValue(outVal, ctx);
+}
+
+// NOTE: vals points into the eval stack, so the stream builtins below copy their
+// args out before calling back into Lisp (which may grow the stack).
+// The source stream is also cleared off the stack, so that already-consumed cells can be freed.
+
+void Builtin_streamMap(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 2);
+	LispValue stream = vals[0];
+	LispValue func = vals[1];
+	vals[0] = LispVoidValue();
+
+	ForceLispValue(&stream, ctx);
+	if (stream.IsLispPairValue()) {
+		LispValue head = stream.AsLispPairValue().Car();
+		LispValue mapped;
+		ApplyLispFunc(&func, &head, 1, &mapped, ctx);
+
+		LispValue restArgs[2];
+		stream.AsLispPairValue().Cdr(&restArgs[0]);
+		restArgs[1] = func;
+
+		LispValue tail;
+		MakeNativePromise(Builtin_streamMap, restArgs, 2, &tail);
+		MakeLispList(&mapped, 1, tail, outVal);
+	}
+	else {
+		*outVal = stream;
+	}
+}
+
+void Builtin_streamFilter(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 2);
+	LispValue stream = vals[0];
+	LispValue pred = vals[1];
+	vals[0] = LispVoidValue();
+
+	ForceLispValue(&stream, ctx);
+	while (stream.IsLispPairValue() && !HasEvalError(ctx)) {
+		LispValue head = stream.AsLispPairValue().Car();
+		LispValue keep;
+		ApplyLispFunc(&pred, &head, 1, &keep, ctx);
+
+		LispValue rest;
+		stream.AsLispPairValue().Cdr(&rest);
+		if (IsLispValueTruthy(keep)) {
+			LispValue restArgs[2] = { rest, pred };
+			LispValue tail;
+			MakeNativePromise(Builtin_streamFilter, restArgs, 2, &tail);
+			MakeLispList(&head, 1, tail, outVal);
+			return;
+		}
+
+		ForceLispValue(&rest, ctx);
+		stream = rest;
+	}
+
+	*outVal = stream;
+}
+
+void Builtin_streamTake(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 2);
+	ASSERT(vals[1].IsLispNumValue());
+	ASSERT(!vals[1].AsLispNumValue().isFloat);
+	LispValue stream = vals[0];
+	LispNumValue remaining = vals[1].AsLispNumValue();
+	vals[0] = LispVoidValue();
+
+	if (remaining.iValue <= 0) {
+		*outVal = LispBoolValue(false);
+		return;
+	}
+
+	ForceLispValue(&stream, ctx);
+	if (stream.IsLispPairValue()) {
+		LispValue restArgs[2];
+		stream.AsLispPairValue().Cdr(&restArgs[0]);
+		remaining.iValue--;
+		restArgs[1] = remaining;
+
+		LispValue tail;
+		MakeNativePromise(Builtin_streamTake, restArgs, 2, &tail);
+		MakeLispList(&stream.AsLispPairValue().Car(), 1, tail, outVal);
+	}
+	else {
+		*outVal = stream;
+	}
+}
+
+// (stream-fold s f init) calls (f acc x) for each element, in constant space
+void Builtin_streamFold(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 3);
+	LispValue stream = vals[0];
+	LispValue func = vals[1];
+	LispValue acc = vals[2];
+	vals[0] = LispVoidValue();
+
+	ForceLispValue(&stream, ctx);
+	while (stream.IsLispPairValue() && !HasEvalError(ctx)) {
+		LispValue args[2] = { acc, stream.AsLispPairValue().Car() };
+		ApplyLispFunc(&func, args, 2, &acc, ctx);
+
+		LispValue rest;
+		stream.AsLispPairValue().Cdr(&rest);
+		ForceLispValue(&rest, ctx);
+		stream = rest;
+	}
+
+	*outVal = acc;
+}
+
+void SexprToValue(BNSexpr* sexpr, LispValue* val);
+
+void OpenPort(LispValue* vals, int count, LispValue* outVal, bool isInput) {
+	ASSERT(count == 1);
+	ASSERT(vals[0].IsLispStringValue());
+	String fileName = vals[0].AsLispStringValue().value;
+	FILE* file = fopen(fileName.string, isInput ? "rb" : "wb");
+	if (file == nullptr) {
+		*outVal = LispBoolValue(false);
+		return;
+	}
+
+	LispPortCell* port = new LispPortCell(file, isInput);
+	if (!isInput) {
+		setvbuf(file, nullptr, _IOFBF, portBufferSize);
+		port->bufferSize = portBufferSize;
+		lispDataBytes += portBufferSize;
+	}
+
+	*outVal = LispPortValue(port);
+}
+
+void Builtin_openInput(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	OpenPort(vals, count, outVal, true);
+}
+
+void Builtin_openOutput(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	OpenPort(vals, count, outVal, false);
+}
+
+void Builtin_closePort(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 1);
+	ASSERT(vals[0].IsLispPortValue());
+	LispPortCell* port = vals[0].AsLispPortValue().cell;
+	if (!CheckWritable(port->serial, ctx)) {
+		*outVal = LispVoidValue();
+		return;
+	}
+
+	port->Close();
+	*outVal = LispVoidValue();
+}
+
+// Hands out the next length buffered bytes as a string. Anything much smaller than the buffer is copied out,
+// since a view into the buffer keeps all of it alive for as long as the string is kept.
+// Bigger results share the buffer: they'd hold most of it anyway, and copying them would cost more.
+void TakeFromPort(LispPortCell* port, int length, LispValue* outVal) {
+	LispStringValue str;
+	if (length < portBufferSize / 4) {
+		String copy = port->buffer.GetSubString(port->readPos, length);
+		str.value = copy.GetSubString(0, length);
+	}
+	else {
+		str.value = port->buffer.GetSubString(port->readPos, length);
+	}
+
+	port->readPos += length;
+	*outVal = str;
+}
+
+// (read-line port) returns the next line without its line ending, or #f at end of file
+void Builtin_readLine(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 1);
+	ASSERT(vals[0].IsLispPortValue());
+	LispPortCell* port = vals[0].AsLispPortValue().cell;
+	ASSERT(port->isInput);
+	if (!CheckWritable(port->serial, ctx)) {
+		*outVal = LispVoidValue();
+		return;
+	}
+
+	int scanned = 0;
+	while (true) {
+		int available = EnsurePortBuffered(port, scanned + 1);
+		const char* start = port->buffer.string + port->readPos;
+		for (; scanned < available; scanned++) {
+			if (start[scanned] == '\n') {
+				int lineLength = (scanned > 0 && start[scanned - 1] == '\r') ? scanned - 1 : scanned;
+				TakeFromPort(port, lineLength, outVal);
+				port->readPos += scanned + 1 - lineLength;
+				return;
+			}
+		}
+
+		if (port->isEOF || port->file == nullptr) {
+			if (available > 0) {
+				TakeFromPort(port, available, outVal);
+			}
+			else {
+				*outVal = LispBoolValue(false);
+			}
+			return;
+		}
+	}
+}
+
+// (read-chunk port n) returns up to n bytes, or #f at end of file
+void Builtin_readChunk(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 2);
+	ASSERT(vals[0].IsLispPortValue());
+	ASSERT(vals[1].IsLispNumValue());
+	ASSERT(!vals[1].AsLispNumValue().isFloat);
+	ASSERT(vals[1].AsLispNumValue().iValue > 0 && vals[1].AsLispNumValue().iValue <= maxReadChunkSize);
+	LispPortCell* port = vals[0].AsLispPortValue().cell;
+	ASSERT(port->isInput);
+	if (!CheckWritable(port->serial, ctx)) {
+		*outVal = LispVoidValue();
+		return;
+	}
+
+	int wanted = (int)vals[1].AsLispNumValue().iValue;
+	int available = EnsurePortBuffered(port, wanted);
+	if (available > 0) {
+		TakeFromPort(port, BNS_MIN(wanted, available), outVal);
+	}
+	else {
+		*outVal = LispBoolValue(false);
+	}
+}
+
+// Returns the length of the sexpr at the start of str, or -1 if it may continue past length
+int FindSexprExtent(const char* str, int length, bool atEOF) {
+	int depth = 0;
+	bool inString = false;
+	for (int i = 0; i < length; i++) {
+		char c = str[i];
+		if (inString) {
+			if (c == '"') {
+				inString = false;
+				if (depth == 0) {
+					return i + 1;
+				}
+			}
+		}
+		else if (c == '"') {
+			inString = true;
+		}
+		else if (c == '(') {
+			depth++;
+		}
+		else if (c == ')') {
+			depth--;
+			if (depth == 0) {
+				return i + 1;
+			}
+		}
+		else if (depth == 0 && (c == ' ' || c == '\t' || c == '\r' || c == '\n')) {
+			return i;
+		}
+	}
+
+	return (atEOF && depth == 0 && !inString) ? length : -1;
+}
+
+// (read-sexpr port) reads the next sexpr as quoted data, or #f at end of file
+void Builtin_readSexpr(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 1);
+	ASSERT(vals[0].IsLispPortValue());
+	LispPortCell* port = vals[0].AsLispPortValue().cell;
+	ASSERT(port->isInput);
+	if (!CheckWritable(port->serial, ctx)) {
+		*outVal = LispVoidValue();
+		return;
+	}
+
+	while (true) {
+		int available = EnsurePortBuffered(port, 1);
+		if (available == 0) {
+			*outVal = LispBoolValue(false);
+			return;
+		}
+
+		char c = port->buffer.string[port->readPos];
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+			port->readPos++;
+		}
+		else {
+			break;
+		}
+	}
+
+	int extent = -1;
+	int wanted = 1;
+	while (true) {
+		int available = EnsurePortBuffered(port, wanted);
+		bool atEOF = (port->isEOF || port->file == nullptr);
+		extent = FindSexprExtent(port->buffer.string + port->readPos, available, atEOF);
+		if (extent >= 0 || atEOF) {
+			break;
+		}
+		wanted = available + 1;
+	}
+
+	ASSERT(extent > 0);
+	String text = port->buffer.GetSubString(port->readPos, extent);
+	port->readPos += extent;
+
+	Vector<BNSexpr> sexprs;
+	ParseSexprs(&sexprs, text);
+	ASSERT(sexprs.count == 1);
+	SexprToValue(&sexprs.data[0], outVal);
+}
+
+// (write-string str) writes to stdout, (write-string str port) to an output port
+void Builtin_writeString(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 1 || count == 2);
+	ASSERT(vals[0].IsLispStringValue());
+	FILE* file = stdout;
+	if (count == 2) {
+		ASSERT(vals[1].IsLispPortValue());
+		LispPortCell* port = vals[1].AsLispPortValue().cell;
+		ASSERT(!port->isInput);
+		if (!CheckWritable(port->serial, ctx)) {
+			*outVal = LispVoidValue();
+			return;
+		}
+
+		file = port->file;
+		ASSERT(file != nullptr);
+	}
+
+	const SubString& str = vals[0].AsLispStringValue().value;
+	fwrite(str.start, 1, str.length, file);
+	*outVal = LispVoidValue();
+}
 
-DEFINE_DISCRIMINATED_UNION(LispValue, DISC_MAC)
+// Numeric kernels for the vector builtins. The scalar/SSE2 versions always work,
+// the AVX2 ones are swapped in at startup if the CPU supports them.
 
-#undef DISC_MAC
+double VectorSumF64_Scalar(const double* a, int count) {
+	double sum = 0.0;
+	for (int i = 0; i < count; i++) {
+		sum += a[i];
+	}
+	return sum;
+}
 
-#define MATH_BUILTIN_OP(name, op)                                                        \
-			void MathBuiltin_ ## name (LispValue* vals, int count, LispValue* outVal) {  \
-				ASSERT(count == 2);                                                      \
-				ASSERT(vals[0].IsLispNumValue());                                        \
-				ASSERT(vals[1].IsLispNumValue());                                        \
-				LispNumValue num = 0.0;                                                  \
-				if (vals[0].AsLispNumValue().isFloat || vals[1].AsLispNumValue().isFloat) {                  \
-					num = vals[0].AsLispNumValue().CoerceDouble() op vals[1].AsLispNumValue().CoerceDouble();\
-				}              \
-				else {         \
-					num = vals[0].AsLispNumValue().iValue op vals[1].AsLispNumValue().iValue;                \
-				}              \
-				*outVal = num; \
-			}
+long long VectorSumI64_Scalar(const long long* a, int count) {
+	long long sum = 0;
+	for (int i = 0; i < count; i++) {
+		sum += a[i];
+	}
+	return sum;
+}
 
-MATH_BUILTIN_OP(Mul, *)
-MATH_BUILTIN_OP(Div, /)
-MATH_BUILTIN_OP(Add, +)
-MATH_BUILTIN_OP(Sub, -)
+void VectorAddF64_Scalar(const double* a, const double* b, double* out, int count) {
+	for (int i = 0; i < count; i++) {
+		out[i] = a[i] + b[i];
+	}
+}
 
-void MathBuiltin_Equ(LispValue* vals, int count, LispValue* outVal) {
-	ASSERT(count == 2);               
-	LispBoolValue res = false;
-	if (vals[0].IsLispNumValue() && vals[1].IsLispNumValue()) {
-		if (vals[0].AsLispNumValue().isFloat || vals[1].AsLispNumValue().isFloat) {
-			res = vals[0].AsLispNumValue().CoerceDouble() == vals[1].AsLispNumValue().CoerceDouble();
-		}
-		else {
-			res = vals[0].AsLispNumValue().iValue == vals[1].AsLispNumValue().iValue;
+void VectorAddI64_Scalar(const long long* a, const long long* b, long long* out, int count) {
+	for (int i = 0; i < count; i++) {
+		out[i] = a[i] + b[i];
+	}
+}
+
+void VectorScaleF64_Scalar(const double* a, double k, double* out, int count) {
+	for (int i = 0; i < count; i++) {
+		out[i] = a[i] * k;
+	}
+}
+
+double VectorDotF64_Scalar(const double* a, const double* b, int count) {
+	double sum = 0.0;
+	for (int i = 0; i < count; i++) {
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+#if defined(BNL_VECTOR_X86)
+
+// Sums are split across several accumulators so the adds can overlap,
+// and vector reductions stay limited by memory bandwidth rather than add latency.
+
+double VectorSumF64_SSE2(const double* a, int count) {
+	__m128d acc0 = _mm_setzero_pd();
+	__m128d acc1 = _mm_setzero_pd();
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		acc0 = _mm_add_pd(acc0, _mm_load_pd(a + i));
+		acc1 = _mm_add_pd(acc1, _mm_load_pd(a + i + 2));
+	}
+
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+	return lanes[0] + lanes[1] + VectorSumF64_Scalar(a + i, count - i);
+}
+
+double VectorDotF64_SSE2(const double* a, const double* b, int count) {
+	__m128d acc0 = _mm_setzero_pd();
+	__m128d acc1 = _mm_setzero_pd();
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_load_pd(a + i), _mm_load_pd(b + i)));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_load_pd(a + i + 2), _mm_load_pd(b + i + 2)));
+	}
+
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+	return lanes[0] + lanes[1] + VectorDotF64_Scalar(a + i, b + i, count - i);
+}
+
+BNL_TARGET_AVX2 double VectorSumF64_AVX2(const double* a, int count) {
+	__m256d acc0 = _mm256_setzero_pd();
+	__m256d acc1 = _mm256_setzero_pd();
+	__m256d acc2 = _mm256_setzero_pd();
+	__m256d acc3 = _mm256_setzero_pd();
+	int i = 0;
+	for (; i + 16 <= count; i += 16) {
+		acc0 = _mm256_add_pd(acc0, _mm256_load_pd(a + i));
+		acc1 = _mm256_add_pd(acc1, _mm256_load_pd(a + i + 4));
+		acc2 = _mm256_add_pd(acc2, _mm256_load_pd(a + i + 8));
+		acc3 = _mm256_add_pd(acc3, _mm256_load_pd(a + i + 12));
+	}
+
+	double lanes[4];
+	_mm256_storeu_pd(lanes, _mm256_add_pd(_mm256_add_pd(acc0, acc1), _mm256_add_pd(acc2, acc3)));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + VectorSumF64_Scalar(a + i, count - i);
+}
+
+BNL_TARGET_AVX2 long long VectorSumI64_AVX2(const long long* a, int count) {
+	__m256i acc0 = _mm256_setzero_si256();
+	__m256i acc1 = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		acc0 = _mm256_add_epi64(acc0, _mm256_load_si256((const __m256i*)(a + i)));
+		acc1 = _mm256_add_epi64(acc1, _mm256_load_si256((const __m256i*)(a + i + 4)));
+	}
+
+	long long lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(acc0, acc1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + VectorSumI64_Scalar(a + i, count - i);
+}
+
+BNL_TARGET_AVX2 void VectorAddF64_AVX2(const double* a, const double* b, double* out, int count) {
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		_mm256_store_pd(out + i, _mm256_add_pd(_mm256_load_pd(a + i), _mm256_load_pd(b + i)));
+	}
+	VectorAddF64_Scalar(a + i, b + i, out + i, count - i);
+}
+
+BNL_TARGET_AVX2 void VectorAddI64_AVX2(const long long* a, const long long* b, long long* out, int count) {
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m256i sum = _mm256_add_epi64(_mm256_load_si256((const __m256i*)(a + i)), _mm256_load_si256((const __m256i*)(b + i)));
+		_mm256_store_si256((__m256i*)(out + i), sum);
+	}
+	VectorAddI64_Scalar(a + i, b + i, out + i, count - i);
+}
+
+BNL_TARGET_AVX2 void VectorScaleF64_AVX2(const double* a, double k, double* out, int count) {
+	__m256d scale = _mm256_set1_pd(k);
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		_mm256_store_pd(out + i, _mm256_mul_pd(_mm256_load_pd(a + i), scale));
+	}
+	VectorScaleF64_Scalar(a + i, k, out + i, count - i);
+}
+
+BNL_TARGET_AVX2 double VectorDotF64_AVX2(const double* a, const double* b, int count) {
+	__m256d acc0 = _mm256_setzero_pd();
+	__m256d acc1 = _mm256_setzero_pd();
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_load_pd(a + i), _mm256_load_pd(b + i)));
+		acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_load_pd(a + i + 4), _mm256_load_pd(b + i + 4)));
+	}
+
+	double lanes[4];
+	_mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + VectorDotF64_Scalar(a + i, b + i, count - i);
+}
+
+bool CPUSupportsAVX2() {
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+
+	// Need the OS to save the YMM registers (OSXSAVE, then XCR0 bits 1 and 2), as well as the instructions themselves
+	__cpuid(info, 1);
+	bool osSavesYMM = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+	__cpuidex(info, 7, 0);
+	return osSavesYMM && (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+struct LispVectorKernels {
+	double (*sumF64)(const double*, int);
+	long long (*sumI64)(const long long*, int);
+	void (*addF64)(const double*, const double*, double*, int);
+	void (*addI64)(const long long*, const long long*, long long*, int);
+	void (*scaleF64)(const double*, double, double*, int);
+	double (*dotF64)(const double*, const double*, int);
+};
+
+LispVectorKernels SelectVectorKernels() {
+	LispVectorKernels kernels;
+	kernels.sumF64 = VectorSumF64_Scalar;
+	kernels.sumI64 = VectorSumI64_Scalar;
+	kernels.addF64 = VectorAddF64_Scalar;
+	kernels.addI64 = VectorAddI64_Scalar;
+	kernels.scaleF64 = VectorScaleF64_Scalar;
+	kernels.dotF64 = VectorDotF64_Scalar;
+
+#if defined(BNL_VECTOR_X86)
+	kernels.sumF64 = VectorSumF64_SSE2;
+	kernels.dotF64 = VectorDotF64_SSE2;
+
+	if (CPUSupportsAVX2()) {
+		kernels.sumF64 = VectorSumF64_AVX2;
+		kernels.sumI64 = VectorSumI64_AVX2;
+		kernels.addF64 = VectorAddF64_AVX2;
+		kernels.addI64 = VectorAddI64_AVX2;
+		kernels.scaleF64 = VectorScaleF64_AVX2;
+		kernels.dotF64 = VectorDotF64_AVX2;
+	}
+#endif
+
+	return kernels;
+}
+
+LispVectorKernels vectorKernels = SelectVectorKernels();
+
+LispNumValue MakeLispInt(long long val) {
+	LispNumValue num = 0;
+	num.iValue = val;
+	return num;
+}
+
+// Returns a new zeroed vector, or nullptr (with an eval error set) if it would go over the data size limit.
+// Checked up front, since one vector can be far bigger than the limit.
+LispVectorData* NewVector(int count, bool isFloat, LispEvalContext* ctx) {
+	if (!CheckDataLimit(sizeof(LispVectorData) + LispVectorData::ByteSize(count), ctx)) {
+		return nullptr;
+	}
+
+	return new LispVectorData(count, isFloat);
+}
+
+void MakeVector(LispValue* vals, int count, LispValue* outVal, bool isFloat, LispEvalContext* ctx) {
+	ASSERT(count == 1 || count == 2);
+	ASSERT(vals[0].IsLispNumValue() && !vals[0].AsLispNumValue().isFloat);
+	long long elemCount = vals[0].AsLispNumValue().iValue;
+	ASSERT(elemCount >= 0 && elemCount <= INT_MAX);
+
+	LispVectorData* data = NewVector((int)elemCount, isFloat, ctx);
+	if (data == nullptr) {
+		*outVal = LispVoidValue();
+		return;
+	}
+
+	*outVal = LispVectorValue(data);
+
+	if (count == 2) {
+		ASSERT(vals[1].IsLispNumValue());
+		const LispNumValue& fill = vals[1].AsLispNumValue();
+		for (int i = 0; i < data->count; i++) {
+			if (isFloat) {
+				data->fValues[i] = fill.CoerceDouble();
+			}
+			else {
+				ASSERT(!fill.isFloat);
+				data->iValues[i] = fill.iValue;
+			}
 		}
 	}
-	*outVal = res;
 }
 
-void StringBuiltin_cmp(LispValue* vals, int count, LispValue* outVal) {
-	ASSERT(count == 2);
-	ASSERT(vals[0].IsLispStringValue());
-	ASSERT(vals[1].IsLispStringValue());
-	int len = BNS_MIN(vals[0].AsLispStringValue().value.length, vals[1].AsLispStringValue().value.length);
-	LispNumValue num = strncmp(vals[0].AsLispStringValue().value.start, vals[1].AsLispStringValue().value.start, len);
-	*outVal = num;
+void Builtin_makeF64Vector(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	MakeVector(vals, count, outVal, true, ctx);
 }
 
-void Builtin_car(LispValue* vals, int count, LispValue* outVal) {
-	ASSERT(count == 1);
-	ASSERT(vals[0].IsLispPairValue());
-	ASSERT(vals[0].AsLispPairValue().vals.count == 2);
-	*outVal = vals[0].AsLispPairValue().vals.data[0];
+void Builtin_makeI64Vector(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	MakeVector(vals, count, outVal, false, ctx);
 }
 
-void Builtin_cdr(LispValue* vals, int count, LispValue* outVal) {
+void Builtin_vectorLength(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
 	ASSERT(count == 1);
-	ASSERT(vals[0].IsLispPairValue());
-	ASSERT(vals[0].AsLispPairValue().vals.count == 2);
-	*outVal = vals[0].AsLispPairValue().vals.data[1];
+	ASSERT(vals[0].IsLispVectorValue());
+	*outVal = MakeLispInt(vals[0].AsLispVectorValue().cell->count);
+}
+
+LispVectorData* GetVectorAndIndex(LispValue* vals, int* outIndex) {
+	ASSERT(vals[0].IsLispVectorValue());
+	ASSERT(vals[1].IsLispNumValue() && !vals[1].AsLispNumValue().isFloat);
+	LispVectorData* data = vals[0].AsLispVectorValue().cell;
+	long long index = vals[1].AsLispNumValue().iValue;
+	ASSERT(index >= 0 && index < data->count);
+	*outIndex = (int)index;
+	return data;
 }
 
-void Builtin_cons(LispValue* vals, int count, LispValue* outVal) {
+void Builtin_vectorRef(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
 	ASSERT(count == 2);
-	LispPairValue res;
-	res.vals.EnsureCapacity(2);
-	res.vals.PushBack(vals[0]);
-	res.vals.PushBack(vals[1]);
+	int index;
+	LispVectorData* data = GetVectorAndIndex(vals, &index);
+	if (data->isFloat) {
+		LispNumValue num = data->fValues[index];
+		*outVal = num;
+	}
+	else {
+		*outVal = MakeLispInt(data->iValues[index]);
+	}
+}
 
-	*outVal = res;
+void Builtin_vectorSet(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 3);
+	ASSERT(vals[2].IsLispNumValue());
+	int index;
+	LispVectorData* data = GetVectorAndIndex(vals, &index);
+
+	const LispNumValue& num = vals[2].AsLispNumValue();
+	if (data->isFloat) {
+		data->fValues[index] = num.CoerceDouble();
+	}
+	else {
+		ASSERT(!num.isFloat);
+		data->iValues[index] = num.iValue;
+	}
+
+	*outVal = LispVoidValue();
 }
 
-void Builtin_isList(LispValue* vals, int count, LispValue* outVal) {
+void Builtin_vectorSum(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
 	ASSERT(count == 1);
-	LispBoolValue res = vals[0].IsLispPairValue();
-	*outVal = res;
+	ASSERT(vals[0].IsLispVectorValue());
+	LispVectorData* data = vals[0].AsLispVectorValue().cell;
+	if (data->isFloat) {
+		LispNumValue num = vectorKernels.sumF64(data->fValues, data->count);
+		*outVal = num;
+	}
+	else {
+		*outVal = MakeLispInt(vectorKernels.sumI64(data->iValues, data->count));
+	}
 }
 
-void Builtin_SymbolEqual(LispValue* vals, int count, LispValue* outVal) {
+// (vector-map+ a b) returns a new vector of the elementwise sums
+void Builtin_vectorAdd(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
 	ASSERT(count == 2);
-	LispBoolValue res = false;
-	if (vals[0].IsLispSymbolValue() && vals[1].IsLispSymbolValue()) {
-		res = vals[0].AsLispSymbolValue().value == vals[1].AsLispSymbolValue().value;
+	ASSERT(vals[0].IsLispVectorValue() && vals[1].IsLispVectorValue());
+	LispVectorData* a = vals[0].AsLispVectorValue().cell;
+	LispVectorData* b = vals[1].AsLispVectorValue().cell;
+	ASSERT(a->isFloat == b->isFloat);
+	ASSERT(a->count == b->count);
+
+	LispVectorData* res = NewVector(a->count, a->isFloat, ctx);
+	if (res == nullptr) {
+		*outVal = LispVoidValue();
+		return;
+	}
+
+	if (a->isFloat) {
+		vectorKernels.addF64(a->fValues, b->fValues, res->fValues, a->count);
+	}
+	else {
+		vectorKernels.addI64(a->iValues, b->iValues, res->iValues, a->count);
+	}
+
+	*outVal = LispVectorValue(res);
+}
+
+// (vector-scale v k) returns a new vector of each element times k
+void Builtin_vectorScale(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 2);
+	ASSERT(vals[0].IsLispVectorValue());
+	ASSERT(vals[1].IsLispNumValue());
+	LispVectorData* a = vals[0].AsLispVectorValue().cell;
+	const LispNumValue& k = vals[1].AsLispNumValue();
+
+	LispVectorData* res = NewVector(a->count, a->isFloat, ctx);
+	if (res == nullptr) {
+		*outVal = LispVoidValue();
+		return;
+	}
+
+	if (a->isFloat) {
+		vectorKernels.scaleF64(a->fValues, k.CoerceDouble(), res->fValues, a->count);
+	}
+	else {
+		// No packed 64-bit multiply before AVX-512, so this one stays scalar
+		ASSERT(!k.isFloat);
+		for (int i = 0; i < a->count; i++) {
+			res->iValues[i] = a->iValues[i] * k.iValue;
+		}
+	}
+
+	*outVal = LispVectorValue(res);
+}
+
+void Builtin_vectorDot(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 2);
+	ASSERT(vals[0].IsLispVectorValue() && vals[1].IsLispVectorValue());
+	LispVectorData* a = vals[0].AsLispVectorValue().cell;
+	LispVectorData* b = vals[1].AsLispVectorValue().cell;
+	ASSERT(a->isFloat == b->isFloat);
+	ASSERT(a->count == b->count);
+
+	if (a->isFloat) {
+		LispNumValue num = vectorKernels.dotF64(a->fValues, b->fValues, a->count);
+		*outVal = num;
+	}
+	else {
+		long long sum = 0;
+		for (int i = 0; i < a->count; i++) {
+			sum += a->iValues[i] * b->iValues[i];
+		}
+		*outVal = MakeLispInt(sum);
 	}
-	*outVal = res;
+}
+
+// (equal? a b) compares numbers, strings, symbols, bools and lists by value. Other values are never equal.
+void Builtin_equal(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 2);
+	*outVal = LispBoolValue(LispValuesEqual(vals[0], vals[1]));
+}
+
+// (memo-stats f) returns (hits misses evictions size) for a define-memo function
+void Builtin_memoStats(LispValue* vals, int count, LispValue* outVal, LispEvalContext* ctx) {
+	ASSERT(count == 1);
+	ASSERT(vals[0].IsLispMemoValue());
+	LispMemoCell* cell = vals[0].AsLispMemoValue().cell;
+
+	LispValue stats[4];
+	stats[0] = MakeLispInt(cell->hits);
+	stats[1] = MakeLispInt(cell->misses);
+	stats[2] = MakeLispInt(cell->evictions);
+	stats[3] = MakeLispInt(cell->entries.count);
+	LispValuesToList(stats, 4, outVal);
 }
 
 struct BuiltinBinding {
@@ -174,7 +1620,32 @@ BuiltinBinding defaultBindings[] = {
 	{ "cdr", Builtin_cdr  },
 	{ "cons", Builtin_cons },
 	{ "list?", Builtin_isList},
-	{"symbol=?", Builtin_SymbolEqual}
+	{"symbol=?", Builtin_SymbolEqual},
+	{ "equal?", Builtin_equal },
+	{ "force", Builtin_force },
+	{ "stream-car", Builtin_streamCar },
+	{ "stream-cdr", Builtin_streamCdr },
+	{ "stream-map", Builtin_streamMap },
+	{ "stream-filter", Builtin_streamFilter },
+	{ "stream-take", Builtin_streamTake },
+	{ "stream-fold", Builtin_streamFold },
+	{ "open-input", Builtin_openInput },
+	{ "open-output", Builtin_openOutput },
+	{ "close-port", Builtin_closePort },
+	{ "read-line", Builtin_readLine },
+	{ "read-chunk", Builtin_readChunk },
+	{ "read-sexpr", Builtin_readSexpr },
+	{ "write-string", Builtin_writeString },
+	{ "make-f64vector", Builtin_makeF64Vector },
+	{ "make-i64vector", Builtin_makeI64Vector },
+	{ "vector-length", Builtin_vectorLength },
+	{ "vector-ref", Builtin_vectorRef },
+	{ "vector-set!", Builtin_vectorSet },
+	{ "vector-sum", Builtin_vectorSum },
+	{ "vector-map+", Builtin_vectorAdd },
+	{ "vector-scale", Builtin_vectorScale },
+	{ "vector-dot", Builtin_vectorDot },
+	{ "memo-stats", Builtin_memoStats }
 };
 
 struct LispBinding {
@@ -182,6 +1653,22 @@ struct LispBinding {
 	LispValue value;
 };
 
+// Per-evaluation resource limits, 0 means unlimited.
+// Breaching one stops the evaluation with ctx->evalError set, rather than crashing.
+struct LispEvalLimits {
+	long long maxSteps;
+	long long maxDataBytes;
+	int maxDepth;
+	int timeoutMs;
+
+	LispEvalLimits() {
+		maxSteps = 0;
+		maxDataBytes = 0;
+		maxDepth = 0;
+		timeoutMs = 0;
+	}
+};
+
 struct LispEvalContext {
 	Vector<LispValue> evalStack;
 	Vector<LispBinding> bindings;
@@ -190,6 +1677,20 @@ struct LispEvalContext {
 	Vector<int> bindingCountFrames;
 	Vector<int> macroCountFrames;
 
+	LispEvalLimits limits;
+
+	// Ports with a serial below this can't be used (see lispObjectSerial)
+	long long sealedSerial;
+
+	// Usage by the current evaluation, reset by BeginEvaluation
+	long long stepCount;
+	int evalDepth;
+	long long startDataBytes;
+	std::chrono::steady_clock::time_point deadline;
+	// Where the current evaluation's stack starts, for the stack guard in CheckEvalLimits
+	const char* stackBase;
+	const char* evalError;
+
 	void PushFrame() {
 		bindingCountFrames.PushBack(bindings.count);
 		macroCountFrames.PushBack(macros.count);
@@ -212,6 +1713,13 @@ struct LispEvalContext {
 	}
 
 	LispEvalContext() {
+		sealedSerial = 0;
+		stepCount = 0;
+		evalDepth = 0;
+		startDataBytes = 0;
+		stackBase = nullptr;
+		evalError = nullptr;
+
 		for (int i = 0; i < BNS_ARRAY_COUNT(defaultBindings); i++) {
 			LispValue val;
 			val = LispBuiltinFuncValue(defaultBindings[i].func);
@@ -234,6 +1742,100 @@ struct LispEvalContext {
 	}
 };
 
+// How much stack an evaluation may use before it's stopped. This guard is always on, since the step limit
+// and timeout don't stop deep recursion from overflowing the stack first.
+size_t GetEvalStackBudget() {
+	static size_t budget = 0;
+	if (budget == 0) {
+#if defined(_WIN32)
+		// The default main thread stack
+		size_t stackSize = 1024 * 1024;
+#else
+		size_t stackSize = 8 * 1024 * 1024;
+		rlimit limit;
+		if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+			stackSize = (size_t)limit.rlim_cur;
+		}
+#endif
+		// Leave room for whatever is below the evaluation, and for the builtins it calls
+		budget = stackSize - BNS_MIN(stackSize / 4, (size_t)1024 * 1024);
+	}
+
+	return budget;
+}
+
+void BeginEvaluation(LispEvalContext* ctx) {
+	char stackMarker;
+	ctx->stackBase = &stackMarker;
+	ctx->stepCount = 0;
+	ctx->evalDepth = 0;
+	ctx->startDataBytes = lispDataBytes;
+	ctx->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ctx->limits.timeoutMs);
+	ctx->evalError = nullptr;
+}
+
+bool HasEvalError(LispEvalContext* ctx) {
+	return ctx->evalError != nullptr;
+}
+
+// Returns false (and stops the evaluation) if allocating newBytes more would go over the data size limit
+bool CheckDataLimit(size_t newBytes, LispEvalContext* ctx) {
+	long long maxDataBytes = ctx->limits.maxDataBytes;
+	if (maxDataBytes > 0 && (long long)newBytes > maxDataBytes - (lispDataBytes - ctx->startDataBytes)) {
+		ctx->evalError = "data size limit exceeded";
+		return false;
+	}
+
+	return true;
+}
+
+// Returns false (and stops the evaluation) if the port with this serial can't be used
+bool CheckWritable(long long serial, LispEvalContext* ctx) {
+	if (serial < ctx->sealedSerial) {
+		ctx->evalError = "cannot use a port shared between requests";
+		return false;
+	}
+
+	return true;
+}
+
+bool IsEvalStackExhausted(LispEvalContext* ctx) {
+	char stackMarker;
+	uintptr_t base = (uintptr_t)ctx->stackBase;
+	uintptr_t current = (uintptr_t)&stackMarker;
+	size_t used = base > current ? base - current : current - base;
+	return used > GetEvalStackBudget();
+}
+
+// Counts one evaluation step, returns false if the evaluation should stop
+bool CheckEvalLimits(LispEvalContext* ctx) {
+	if (ctx->evalError != nullptr) {
+		return false;
+	}
+
+	const LispEvalLimits& limits = ctx->limits;
+	ctx->stepCount++;
+	if (limits.maxSteps > 0 && ctx->stepCount > limits.maxSteps) {
+		ctx->evalError = "step limit exceeded";
+	}
+	else if (limits.maxDepth > 0 && ctx->evalDepth >= limits.maxDepth) {
+		ctx->evalError = "recursion depth limit exceeded";
+	}
+	else if (ctx->stackBase != nullptr && IsEvalStackExhausted(ctx)) {
+		ctx->evalError = "recursion too deep for the stack";
+	}
+	else if (limits.maxDataBytes > 0 && lispDataBytes - ctx->startDataBytes > limits.maxDataBytes) {
+		ctx->evalError = "data size limit exceeded";
+	}
+	// Reading the clock is comparatively slow, so only do it every so often
+	else if (limits.timeoutMs > 0 && (ctx->stepCount & 1023) == 0
+		  && std::chrono::steady_clock::now() > ctx->deadline) {
+		ctx->evalError = "deadline exceeded";
+	}
+
+	return ctx->evalError == nullptr;
+}
+
 LispValue GetBindingForIdentifier(const SubString& name, LispEvalContext* ctx) {
 	for (int i = ctx->bindings.count - 1; i >= 0; i--) {
 		if (name == ctx->bindings.data[i].name) {
@@ -254,7 +1856,8 @@ LispValue GetBindingForIdentifier(BNSexpr* sexpr, LispEvalContext* ctx) {
 void GetClosureBindings(BNSexpr* funcBody, LispEvalContext* ctx, Vector<LispBinding>* outClosureBindings) {
 	if (funcBody->IsBNSexprIdentifier()) {
 		const SubString& name = funcBody->AsBNSexprIdentifier().identifier;
-		if (name != "begin" && name != "define" && name != "if" && name != "defmacro") {
+		if (name != "begin" && name != "define" && name != "if" && name != "defmacro"
+		 && name != "delay" && name != "stream-cons" && name != "define-memo") {
 			LispValue val = GetBindingForIdentifier(name, ctx);
 			if (!val.IsLispVoidValue()) {
 				LispBinding bind;
@@ -303,21 +1906,14 @@ void EvalSexpr(BNSexpr* sexpr, LispEvalContext* ctx);
 
 void SexprToValue(BNSexpr* sexpr, LispValue* val) {
 	if (sexpr->IsBNSexprParenList()) {
-		LispBoolValue empty;
-		empty.val = false;
-		*val = empty;
-
-		for (int i = sexpr->AsBNSexprParenList().children.count - 1; i >= 0; i--) {
-			LispPairValue pair;
-			pair.vals.EnsureCapacity(2);
-
-			LispValue head;
-			SexprToValue(&sexpr->AsBNSexprParenList().children.data[i], &head);
-
-			pair.vals.PushBack(head);
-			pair.vals.PushBack(*val);
-			*val = pair;
+		const Vector<BNSexpr>& children = sexpr->AsBNSexprParenList().children;
+		Vector<LispValue> elems;
+		elems.EnsureCapacity(children.count);
+		BNS_VEC_FOREACH(children) {
+			SexprToValue(ptr, &elems.EmplaceBack());
 		}
+
+		LispValuesToList(elems.data, elems.count, val);
 	}
 	else if (sexpr->IsBNSexprIdentifier()) {
 		LispSymbolValue sym;
@@ -343,11 +1939,12 @@ void ValueToSexpr(LispValue* val, BNSexpr* sexpr) {
 	}
 	else if (val->IsLispPairValue()) {
 		BNSexprParenList paren;
-		while (val->IsLispPairValue()) {
-			LispValue* head = &val->AsLispPairValue().vals.data[0];
+		LispValue cursor = *val;
+		while (cursor.IsLispPairValue()) {
+			LispValue head = cursor.AsLispPairValue().Car();
 			BNSexpr& newSexpr = paren.children.EmplaceBack();
-			ValueToSexpr(head, &newSexpr);
-			val = &val->AsLispPairValue().vals.data[1];
+			ValueToSexpr(&head, &newSexpr);
+			AdvanceLispList(&cursor);
 		}
 
 		*sexpr = paren;
@@ -390,21 +1987,14 @@ void ApplyLispMacro(LispMacro* macro, BNSexpr* sexpr, BNSexpr* result, LispEvalC
 			ctx->bindings.PushBack(binding);
 		}
 
-		LispValue lastArg;
-		lastArg = LispBoolValue(false);
+		Vector<LispValue> varArgs;
 		for (int i = nonVarArgCount + 1; i < sexpr->AsBNSexprParenList().children.count; i++) {
-			LispPairValue pair;
-			pair.vals.EnsureCapacity(2);
-			pair.vals.EmplaceBack();
-			pair.vals.EmplaceBack();
-			SexprToValue(&sexpr->AsBNSexprParenList().children.data[i], &pair.vals.data[0]);
-			pair.vals.data[1] = lastArg;
-			lastArg = pair;
+			SexprToValue(&sexpr->AsBNSexprParenList().children.data[i], &varArgs.EmplaceBack());
 		}
 
 		LispBinding binding;
 		binding.name = macro->argNames.data[nonVarArgCount];
-		binding.value = lastArg;
+		LispValuesToList(varArgs.data, varArgs.count, &binding.value);
 		ctx->bindings.PushBack(binding);
 	}
 	else {
@@ -416,51 +2006,176 @@ void ApplyLispMacro(LispMacro* macro, BNSexpr* sexpr, BNSexpr* result, LispEvalC
 		}
 	}
 
-	LispBinding recurBinding;
-	recurBinding.name = macro->name;
-	LispLambdaValue val;
-	val.argNames = macro->argNames;
-	val.closureBindings = macro->closureBindings;
-	val.body = macro->body;
-	val.isVariadic = macro->isVariadic;
-	recurBinding.value = val;
+	LispBinding recurBinding;
+	recurBinding.name = macro->name;
+	LispLambdaValue val;
+	val.argNames = macro->argNames;
+	val.closureBindings = macro->closureBindings;
+	val.body = macro->body;
+	val.isVariadic = macro->isVariadic;
+	recurBinding.value = val;
+
+	ctx->bindings.PushBack(recurBinding);
+
+	int macroIdx = -1;
+	for (int i = 0; i < ctx->macros.count; i++) {
+		if (ctx->macros.data[i].name == macro->name) {
+			macroIdx = i;
+			break;
+		}
+	}
+
+	ASSERT(macroIdx >= 0);
+	SubString macroName = ctx->macros.data[macroIdx].name;
+	ctx->macros.data[macroIdx].name.length = 0;
+
+	EvalSexpr(&macro->body, ctx);
+
+	// On error, leave result empty: evaluating it will just unwind
+	if (ctx->evalError == nullptr) {
+		ValueToSexpr(&ctx->evalStack.Back(), result);
+	}
+	ctx->evalStack.PopBack();
+
+	ctx->macros.data[macroIdx].name = macroName;
+
+	ctx->PopFrame();
+}
+
+// Pushes the closure bindings and arguments for a call to lambda onto ctx->bindings.
+// selfBinding, if given, goes between the two (used by define-memo functions to refer to themselves).
+void BindLambdaArgs(LispLambdaValue* lambda, const LispValue* args, int argCount, LispEvalContext* ctx, const LispBinding* selfBinding = nullptr) {
+	int arity = lambda->argNames.count;
+	ASSERT(lambda->isVariadic || arity == argCount);
+
+	// Put closures on first, so args can override them
+	BNS_VEC_FOREACH(lambda->closureBindings) {
+		ctx->bindings.PushBack(*ptr);
+	}
+
+	if (selfBinding != nullptr) {
+		ctx->bindings.PushBack(*selfBinding);
+	}
+
+	if (lambda->isVariadic) {
+		int nonVarArgCount = arity - 1;
+		ASSERT(argCount >= nonVarArgCount);
+		for (int i = 0; i < nonVarArgCount; i++) {
+			LispBinding binding;
+			binding.name = lambda->argNames.data[i];
+			binding.value = args[i];
+			ctx->bindings.PushBack(binding);
+		}
+
+		LispBinding binding;
+		binding.name = lambda->argNames.Back();
+		LispValuesToList(&args[nonVarArgCount], argCount - nonVarArgCount, &binding.value);
+		ctx->bindings.PushBack(binding);
+	}
+	else {
+		for (int i = 0; i < arity; i++) {
+			LispBinding binding;
+			binding.name = lambda->argNames.data[i];
+			binding.value = args[i];
+			ctx->bindings.PushBack(binding);
+		}
+	}
+}
+
+// Fills in the arg names of a lambda from its signature, e.g. (name a b ...). Returns false if it's malformed
+bool ParseLambdaArgNames(const Vector<BNSexpr>& signature, LispLambdaValue* outVal) {
+	if (signature.count == 0) {
+		return false;
+	}
+
+	BNS_VEC_FOREACH(signature) {
+		if (!ptr->IsBNSexprIdentifier()) {
+			return false;
+		}
+	}
+
+	outVal->argNames.EnsureCapacity(signature.count - 1);
+	for (int i = 1; i < signature.count; i++) {
+		outVal->argNames.PushBack(signature.data[i].AsBNSexprIdentifier().identifier);
+	}
 
-	ctx->bindings.PushBack(recurBinding);
+	if (outVal->argNames.count > 0 && outVal->argNames.Back() == "...") {
+		outVal->argNames.PopBack();
+		outVal->isVariadic = true;
+	}
 
-	int macroIdx = -1;
-	for (int i = 0; i < ctx->macros.count; i++) {
-		if (ctx->macros.data[i].name == macro->name) {
-			macroIdx = i;
-			break;
+	return true;
+}
+
+void CallLispMemo(LispValue* memoVal, const LispValue* args, int argCount, LispValue* outVal, LispEvalContext* ctx) {
+	// Copy everything out first: args may point into the eval stack, and memoVal may be on it
+	LispValue self = *memoVal;
+	LispMemoCell* cell = self.AsLispMemoValue().cell;
+
+	Vector<LispValue> key;
+	key.EnsureCapacity(argCount);
+	for (int i = 0; i < argCount; i++) {
+		key.PushBack(args[i]);
+	}
+
+	unsigned int hash = 2166136261u;
+	bool isCacheable = true;
+	for (int i = 0; i < argCount && isCacheable; i++) {
+		isCacheable = HashLispValue(key.data[i], &hash);
+	}
+
+	if (isCacheable) {
+		int index = MemoLookup(cell, key.data, key.count, hash);
+		if (index >= 0) {
+			cell->hits++;
+			MemoUnlinkLRU(cell, index);
+			MemoPushLRU(cell, index);
+			*outVal = cell->entries.data[index].result;
+			return;
 		}
 	}
 
-	ASSERT(macroIdx >= 0);
-	SubString macroName = ctx->macros.data[macroIdx].name;
-	ctx->macros.data[macroIdx].name.length = 0;
+	cell->misses++;
 
-	EvalSexpr(&macro->body, ctx);
+	LispBinding selfBinding;
+	selfBinding.name = cell->name;
+	selfBinding.value = self;
 
-	ValueToSexpr(&ctx->evalStack.Back(), result);
+	int prevCount = ctx->bindings.count;
+	BindLambdaArgs(&cell->func.AsLispLambdaValue(), key.data, key.count, ctx, &selfBinding);
+
+	EvalSexpr(&cell->func.AsLispLambdaValue().body, ctx);
+	LispValue result = ctx->evalStack.Back();
 	ctx->evalStack.PopBack();
 
-	ctx->macros.data[macroIdx].name = macroName;
+	ctx->bindings.RemoveRange(prevCount, ctx->bindings.count);
 
-	ctx->PopFrame();
+	// A result cut short by an eval limit isn't the real answer, so don't keep it
+	if (isCacheable && !HasEvalError(ctx)) {
+		MemoInsert(cell, key.data, key.count, hash, result);
+	}
+
+	*outVal = result;
 }
 
-void LispValuesToList(const LispValue* vals, int count, LispValue* outVal) {
-	LispBoolValue end = false;
-	*outVal = end;
-	for (int i = count - 1; i >= 0; i--) {
-		LispPairValue pair;
-		pair.vals.PushBack(vals[i]);
-		pair.vals.PushBack(*outVal);
-		*outVal = pair;
-	}
+void MakeLispPromise(BNSexpr* body, LispEvalContext* ctx, LispValue* outVal) {
+	LispPromiseValue promise;
+	promise.cell->body = *body;
+	GetClosureBindings(body, ctx, &promise.cell->closureBindings);
+	*outVal = promise;
 }
 
 void EvalSexpr(BNSexpr* sexpr, LispEvalContext* ctx) {
+	if (!CheckEvalLimits(ctx)) {
+		// Still push a result, so callers unwind normally
+		LispValue val;
+		val = LispVoidValue();
+		ctx->evalStack.PushBack(val);
+		return;
+	}
+
+	ctx->evalDepth++;
+
 	if (sexpr->IsBNSexprParenList()) {
 		const Vector<BNSexpr>& children = sexpr->AsBNSexprParenList().children;
 		bool specialCase = false;
@@ -473,6 +2188,10 @@ void EvalSexpr(BNSexpr* sexpr, LispEvalContext* ctx) {
 						EvalSexpr(&children.data[2], ctx);
 						LispValue val = ctx->evalStack.Back();
 						ctx->evalStack.PopBack();
+						if (ctx->evalError != nullptr) {
+							val = LispVoidValue();
+						}
+
 						LispBinding binding;
 						binding.name = children.data[1].AsBNSexprIdentifier().identifier;
 						binding.value = val;
@@ -481,38 +2200,15 @@ void EvalSexpr(BNSexpr* sexpr, LispEvalContext* ctx) {
 					else if (children.data[1].IsBNSexprParenList()) {
 						LispLambdaValue val;
 						const Vector<BNSexpr>& grandChildren = children.data[1].AsBNSexprParenList().children;
-						if (grandChildren.count > 0) {
-							bool allIdentifiers = true;
-							BNS_VEC_FOREACH(grandChildren) {
-								if (!ptr->IsBNSexprIdentifier()) {
-									allIdentifiers = false;
-									break;
-								}
-							}
-
-							if (allIdentifiers) {
-								LispBinding binding;
-								binding.name = grandChildren.data[0].AsBNSexprIdentifier().identifier;
-
-								val.argNames.EnsureCapacity(grandChildren.count - 1);
-								for (int i = 1; i < grandChildren.count; i++) {
-									val.argNames.PushBack(grandChildren.data[i].AsBNSexprIdentifier().identifier);
-								}
-
-								if (val.argNames.Back() == "...") {
-									val.argNames.PopBack();
-									val.isVariadic = true;
-								}
-
-								val.body = children.data[2];
-								GetClosureBindings(&val.body, ctx, &val.closureBindings);
-								binding.value = val;
-								ctx->bindings.PushBack(binding);
-								ctx->bindings.Back().value.AsLispLambdaValue().closureBindings.PushBack(binding);
-							}
-							else {
-								ASSERT(false);
-							}
+						if (ParseLambdaArgNames(grandChildren, &val)) {
+							LispBinding binding;
+							binding.name = grandChildren.data[0].AsBNSexprIdentifier().identifier;
+
+							val.body = children.data[2];
+							GetClosureBindings(&val.body, ctx, &val.closureBindings);
+							binding.value = val;
+							ctx->bindings.PushBack(binding);
+							ctx->bindings.Back().value.AsLispLambdaValue().closureBindings.PushBack(binding);
 						}
 						else {
 							ASSERT(false);
@@ -560,6 +2256,62 @@ void EvalSexpr(BNSexpr* sexpr, LispEvalContext* ctx) {
 					EvalSexpr(thenExpr, ctx);
 				}
 			}
+			else if (children.data[0].IsBNSexprIdentifier()
+				&& children.data[0].AsBNSexprIdentifier().identifier == "define-memo") {
+				// (define-memo (name args...) body [capacity])
+				specialCase = true;
+				ASSERT(children.count == 3 || children.count == 4);
+				ASSERT(children.data[1].IsBNSexprParenList());
+				LispLambdaValue val;
+				const Vector<BNSexpr>& grandChildren = children.data[1].AsBNSexprParenList().children;
+				if (ParseLambdaArgNames(grandChildren, &val)) {
+					int capacity = defaultMemoCapacity;
+					if (children.count == 4) {
+						ASSERT(children.data[3].IsBNSexprNumber());
+						capacity = (int)children.data[3].AsBNSexprNumber().iValue;
+					}
+
+					val.body = children.data[2];
+					GetClosureBindings(&val.body, ctx, &val.closureBindings);
+
+					// The function refers to itself through CallLispMemo's self binding rather than
+					// its closure, so recursive calls hit the cache (and the cell doesn't own itself)
+					LispMemoCell* cell = new LispMemoCell(capacity);
+					cell->name = grandChildren.data[0].AsBNSexprIdentifier().identifier;
+					cell->func = val;
+
+					LispBinding binding;
+					binding.name = grandChildren.data[0].AsBNSexprIdentifier().identifier;
+					binding.value = LispMemoValue(cell);
+					ctx->bindings.PushBack(binding);
+				}
+				else {
+					ASSERT(false);
+				}
+			}
+			else if (children.data[0].IsBNSexprIdentifier()
+				&& children.data[0].AsBNSexprIdentifier().identifier == "delay") {
+				specialCase = true;
+				ASSERT(children.count == 2);
+				LispValue val;
+				MakeLispPromise(&children.data[1], ctx, &val);
+				ctx->evalStack.PushBack(val);
+			}
+			else if (children.data[0].IsBNSexprIdentifier()
+				&& children.data[0].AsBNSexprIdentifier().identifier == "stream-cons") {
+				specialCase = true;
+				ASSERT(children.count == 3);
+				EvalSexpr(&children.data[1], ctx);
+				LispValue head = ctx->evalStack.Back();
+				ctx->evalStack.PopBack();
+
+				LispValue tail;
+				MakeLispPromise(&children.data[2], ctx, &tail);
+
+				LispValue val;
+				MakeLispList(&head, 1, tail, &val);
+				ctx->evalStack.PushBack(val);
+			}
 			else if (children.data[0].IsBNSexprIdentifier()
 				&& children.data[0].AsBNSexprIdentifier().identifier == "defmacro") {
 				specialCase = true;
@@ -612,59 +2364,34 @@ void EvalSexpr(BNSexpr* sexpr, LispEvalContext* ctx) {
 					EvalSexpr(ptr, ctx);
 				}
 
-				if (ctx->evalStack.count > idx) {
+				if (ctx->evalError != nullptr) {
+					LispValue val;
+					val = LispVoidValue();
+					ctx->evalStack.RemoveRange(idx, ctx->evalStack.count);
+					ctx->evalStack.PushBack(val);
+				}
+				else if (ctx->evalStack.count > idx) {
 					LispValue func = ctx->evalStack.data[idx];
 					if (func.IsLispBuiltinFuncValue()) {
 						LispValue result;
-						func.AsLispBuiltinFuncValue().func(&ctx->evalStack.data[idx + 1], ctx->evalStack.count - idx - 1, &result);
+						func.AsLispBuiltinFuncValue().func(&ctx->evalStack.data[idx + 1], ctx->evalStack.count - idx - 1, &result, ctx);
 						ctx->evalStack.RemoveRange(idx, ctx->evalStack.count);
 						ctx->evalStack.PushBack(result);
 					}
 					else if (func.IsLispLambdaValue()) {
-						int arity = func.AsLispLambdaValue().argNames.count;
-						int argCount = ctx->evalStack.count - idx - 1;
-						if (func.AsLispLambdaValue().isVariadic || arity == argCount) {
-							int prevCount = ctx->bindings.count;
-
-							// Put closures on first, so args can override them
-							BNS_VEC_FOREACH(func.AsLispLambdaValue().closureBindings) {
-								ctx->bindings.PushBack(*ptr);
-							}
-
-							if (func.AsLispLambdaValue().isVariadic) {
-								int nonVarArgCount = func.AsLispLambdaValue().argNames.count - 1;
-								ASSERT(sexpr->AsBNSexprParenList().children.count - 1 >= nonVarArgCount);
-								for (int i = 1; i <= nonVarArgCount; i++) {
-									LispBinding binding;
-									binding.name = func.AsLispLambdaValue().argNames.data[i]; 
-									binding.value = ctx->evalStack.data[idx + 1 + i];
-									ctx->bindings.PushBack(binding);
-								}
-
-								LispBinding binding;
-								binding.name = func.AsLispLambdaValue().argNames.Back();
-								LispValuesToList(&ctx->evalStack.data[idx + 1 + nonVarArgCount], 
-												 ctx->evalStack.count - idx - nonVarArgCount - 1, &binding.value);
-								ctx->bindings.PushBack(binding);
-							}
-							else {
-								for (int i = 0; i < arity; i++) {
-									LispBinding binding;
-									binding.name = func.AsLispLambdaValue().argNames.data[i];
-									binding.value = ctx->evalStack.data[idx + 1 + i];
-									ctx->bindings.PushBack(binding);
-								}
-							}
-
-							ctx->evalStack.RemoveRange(idx, ctx->evalStack.count);
-
-							EvalSexpr(&func.AsLispLambdaValue().body, ctx);
-
-							ctx->bindings.RemoveRange(prevCount, ctx->bindings.count);
-						}
-						else {
-							ASSERT(false);
-						}
+						int prevCount = ctx->bindings.count;
+						BindLambdaArgs(&func.AsLispLambdaValue(), &ctx->evalStack.data[idx + 1], ctx->evalStack.count - idx - 1, ctx);
+						ctx->evalStack.RemoveRange(idx, ctx->evalStack.count);
+
+						EvalSexpr(&func.AsLispLambdaValue().body, ctx);
+
+						ctx->bindings.RemoveRange(prevCount, ctx->bindings.count);
+					}
+					else if (func.IsLispMemoValue()) {
+						LispValue result;
+						CallLispMemo(&func, &ctx->evalStack.data[idx + 1], ctx->evalStack.count - idx - 1, &result, ctx);
+						ctx->evalStack.RemoveRange(idx, ctx->evalStack.count);
+						ctx->evalStack.PushBack(result);
 					}
 					else if (func.IsLispVoidValue()) {
 						printf("Error, unbound identifier\n");
@@ -708,11 +2435,90 @@ void EvalSexpr(BNSexpr* sexpr, LispEvalContext* ctx) {
 	else {
 		ASSERT(false);
 	}
+
+	ctx->evalDepth--;
+}
+
+void ApplyLispFunc(LispValue* func, LispValue* args, int argCount, LispValue* outVal, LispEvalContext* ctx) {
+	if (ctx->evalError != nullptr) {
+		*outVal = LispVoidValue();
+	}
+	else if (func->IsLispBuiltinFuncValue()) {
+		func->AsLispBuiltinFuncValue().func(args, argCount, outVal, ctx);
+	}
+	else if (func->IsLispLambdaValue()) {
+		int prevCount = ctx->bindings.count;
+		BindLambdaArgs(&func->AsLispLambdaValue(), args, argCount, ctx);
+
+		EvalSexpr(&func->AsLispLambdaValue().body, ctx);
+		*outVal = ctx->evalStack.Back();
+		ctx->evalStack.PopBack();
+
+		ctx->bindings.RemoveRange(prevCount, ctx->bindings.count);
+	}
+	else if (func->IsLispMemoValue()) {
+		CallLispMemo(func, args, argCount, outVal, ctx);
+	}
+	else {
+		ASSERT(false);
+	}
+}
+
+void ForceLispValue(LispValue* val, LispEvalContext* ctx) {
+	if (!val->IsLispPromiseValue()) {
+		return;
+	}
+
+	// Hold our own reference, since overwriting *val may release the cell
+	LispPromiseValue promise = val->AsLispPromiseValue();
+	LispPromiseCell* cell = promise.cell;
+	if (!cell->isForced) {
+		LispValue result;
+		if (cell->thunk != nullptr) {
+			// The stream builtins clear the source stream out of their args as they go. Give them a copy,
+			// so that if a limit stops this force, the promise still has what it needs to be forced again.
+			Vector<LispValue> args = cell->thunkArgs;
+			cell->thunk(args.data, args.count, &result, ctx);
+		}
+		else {
+			int prevCount = ctx->bindings.count;
+			BNS_VEC_FOREACH(cell->closureBindings) {
+				ctx->bindings.PushBack(*ptr);
+			}
+
+			EvalSexpr(&cell->body, ctx);
+			result = ctx->evalStack.Back();
+			ctx->evalStack.PopBack();
+
+			ctx->bindings.RemoveRange(prevCount, ctx->bindings.count);
+		}
+
+		// Leave the promise unforced, and *val as it was
+		if (ctx->evalError != nullptr) {
+			return;
+		}
+
+		cell->value = result;
+		cell->isForced = true;
+
+		// Drop whatever the computation referenced, so a consumed stream can be freed
+		cell->closureBindings.Clear();
+		cell->thunkArgs.Clear();
+	}
+
+	*val = cell->value;
 }
 
 void EvalSexprs(Vector<BNSexpr>* sexprs, LispEvalContext* ctx) {
+	BeginEvaluation(ctx);
 	BNS_VEC_FOREACH(*sexprs) {
+		int stackCount = ctx->evalStack.count;
 		EvalSexpr(ptr, ctx);
+		if (ctx->evalError != nullptr) {
+			// Whatever the failed expression left is a partial result, don't report it
+			ctx->evalStack.RemoveRange(stackCount, ctx->evalStack.count);
+			break;
+		}
 	}
 }
 
@@ -732,10 +2538,13 @@ void PrintLispValue(LispValue* val, FILE* file = stdout) {
 		fprintf(file, "%s", val->AsLispBoolValue().val ? "#t" : "#f");
 	}
 	else if (val->IsLispPairValue()) {
+		LispValue head = val->AsLispPairValue().Car();
+		LispValue tail;
+		val->AsLispPairValue().Cdr(&tail);
 		fprintf(file, "(cons ");
-		PrintLispValue(&val->AsLispPairValue().vals.data[0], file);
+		PrintLispValue(&head, file);
 		fprintf(file, " ");
-		PrintLispValue(&val->AsLispPairValue().vals.data[1], file);
+		PrintLispValue(&tail, file);
 		fprintf(file, ")");
 	}
 	else if (val->IsLispSymbolValue()) {
@@ -744,37 +2553,471 @@ void PrintLispValue(LispValue* val, FILE* file = stdout) {
 	else if (val->IsLispVoidValue()) {
 		fprintf(file, "#<void>");
 	}
-	else if (val->IsLispLambdaValue()) {
+	else if (val->IsLispLambdaValue() || val->IsLispMemoValue()) {
 		fprintf(file, "#<proc>");
 	}
+	else if (val->IsLispPromiseValue()) {
+		fprintf(file, "#<promise>");
+	}
+	else if (val->IsLispPortValue()) {
+		fprintf(file, "#<port>");
+	}
+	else if (val->IsLispVectorValue()) {
+		LispVectorData* data = val->AsLispVectorValue().cell;
+		fprintf(file, data->isFloat ? "#f64(" : "#i64(");
+		for (int i = 0; i < data->count; i++) {
+			if (data->isFloat) {
+				fprintf(file, i > 0 ? " %f" : "%f", data->fValues[i]);
+			}
+			else {
+				fprintf(file, i > 0 ? " %lld" : "%lld", data->iValues[i]);
+			}
+		}
+		fprintf(file, ")");
+	}
 	else {
 		// TODO
 		ASSERT(false);
 	}
 }
 
+// Prints (and clears) the values left by EvalSexprs, followed by the error that stopped it, if any
+void PrintEvalResults(LispEvalContext* ctx, FILE* file = stdout) {
+	BNS_VEC_FOREACH(ctx->evalStack) {
+		PrintLispValue(ptr, file);
+		fprintf(file, "\n");
+	}
+
+	if (ctx->evalError != nullptr) {
+		fprintf(file, "Error, %s\n", ctx->evalError);
+	}
+
+	ctx->evalStack.Clear();
+}
+
 #include "../CppUtils/strings.cpp"
 #include "../CppUtils/assert.cpp"
 #include "../CppUtils/vector.cpp"
 #include "../CppUtils/sexpr.cpp"
 
+#if !defined(_WIN32)
+
+// --serve protocol: every request and response is a 4-byte little-endian length followed by that many bytes.
+// A request is source text, its response is the printed results (one per line, like the REPL).
+// Clients may pipeline any number of requests on a connection, responses come back in order.
+// A request longer than maxServerRequestSize closes the connection.
+
+static const unsigned int maxServerRequestSize = 64 * 1024 * 1024;
+
+struct LispServerConnection {
+	int fd;
+	// Bytes before inStart/outStart have already been handled. They're only dropped once they make up
+	// most of the buffer, so working through a large buffer doesn't keep moving the rest of it down.
+	Vector<char> inBuffer;
+	int inStart;
+	Vector<char> outBuffer;
+	int outStart;
+
+	LispServerConnection() {
+		fd = -1;
+		inStart = 0;
+		outStart = 0;
+	}
+};
+
+void AppendBytes(Vector<char>* buffer, const char* bytes, int length) {
+	if (buffer->count + length > buffer->capacity) {
+		buffer->EnsureCapacity(BNS_MAX(buffer->count + length, buffer->capacity * 2));
+	}
+
+	memcpy(buffer->data + buffer->count, bytes, length);
+	buffer->count += length;
+}
+
+void DropHandledBytes(Vector<char>* buffer, int* start) {
+	if (*start == buffer->count) {
+		buffer->Clear();
+		*start = 0;
+	}
+	else if (*start > buffer->count / 2) {
+		buffer->RemoveRange(0, *start);
+		*start = 0;
+	}
+}
+
+void AppendResponse(Vector<char>* outBuffer, const char* response, int responseLength) {
+	unsigned char header[4];
+	for (int i = 0; i < 4; i++) {
+		header[i] = (unsigned char)(responseLength >> (8 * i));
+	}
+
+	AppendBytes(outBuffer, (const char*)header, 4);
+	AppendBytes(outBuffer, response, responseLength);
+}
+
+// Each request is evaluated in a forked copy of the server, so it starts from exactly the state the prelude left.
+// Nothing it does (definitions, vector-set!, forcing promises, filling define-memo caches) is seen by later requests,
+// and if it crashes (e.g. a failed ASSERT) only its own response is lost.
+// Everything the copy prints to stdout, the results as well as write-string output, becomes the response.
+void EvalServerRequest(const char* source, int length, LispEvalContext* ctx, Vector<char>* outBuffer) {
+	int pipeFds[2];
+	if (pipe(pipeFds) != 0) {
+		static const char pipeError[] = "Error, could not start evaluating the request\n";
+		AppendResponse(outBuffer, pipeError, sizeof(pipeError) - 1);
+		return;
+	}
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(pipeFds[0]);
+		dup2(pipeFds[1], STDOUT_FILENO);
+		close(pipeFds[1]);
+
+		Vector<char> sourceText;
+		AppendBytes(&sourceText, source, length);
+		sourceText.PushBack('\0');
+
+		Vector<BNSexpr> sexprs;
+		ParseSexprs(&sexprs, sourceText.data);
+		EvalSexprs(&sexprs, ctx);
+		PrintEvalResults(ctx);
+
+		// Skip freeing everything on the way out, the whole copy is about to go away
+		fflush(stdout);
+		_exit(0);
+	}
+
+	close(pipeFds[1]);
+
+	Vector<char> response;
+	while (pid > 0) {
+		char readBuffer[64 * 1024];
+		ssize_t readCount = read(pipeFds[0], readBuffer, sizeof(readBuffer));
+		if (readCount > 0) {
+			AppendBytes(&response, readBuffer, (int)readCount);
+		}
+		else if (readCount == 0 || errno != EINTR) {
+			break;
+		}
+	}
+
+	close(pipeFds[0]);
+
+	int status = 0;
+	while (pid > 0 && waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+	}
+
+	if (pid < 0) {
+		static const char forkError[] = "Error, could not start evaluating the request\n";
+		AppendBytes(&response, forkError, sizeof(forkError) - 1);
+	}
+	else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		char crashError[64];
+		int crashLength = snprintf(crashError, sizeof(crashError), "Error, request crashed (signal %d)\n",
+		                           WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+		AppendBytes(&response, crashError, crashLength);
+	}
+
+	AppendResponse(outBuffer, response.data, response.count);
+}
+
+// Reads whatever is available and evaluates every complete request in it.
+// Returns false once the client is gone, or has sent a malformed request.
+bool ServiceConnectionInput(LispServerConnection* conn, LispEvalContext* ctx) {
+	while (true) {
+		char readBuffer[64 * 1024];
+		ssize_t readCount = read(conn->fd, readBuffer, sizeof(readBuffer));
+		if (readCount > 0) {
+			AppendBytes(&conn->inBuffer, readBuffer, (int)readCount);
+		}
+		else if (readCount == 0) {
+			return false;
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			break;
+		}
+		else if (errno != EINTR) {
+			return false;
+		}
+	}
+
+	while (conn->inBuffer.count - conn->inStart >= 4) {
+		const unsigned char* header = (const unsigned char*)conn->inBuffer.data + conn->inStart;
+		unsigned int length = (unsigned int)header[0] | ((unsigned int)header[1] << 8)
+		                    | ((unsigned int)header[2] << 16) | ((unsigned int)header[3] << 24);
+		if (length > maxServerRequestSize) {
+			return false;
+		}
+
+		if ((unsigned int)(conn->inBuffer.count - conn->inStart - 4) < length) {
+			break;
+		}
+
+		EvalServerRequest(conn->inBuffer.data + conn->inStart + 4, (int)length, ctx, &conn->outBuffer);
+		conn->inStart += 4 + (int)length;
+	}
+
+	DropHandledBytes(&conn->inBuffer, &conn->inStart);
+	return true;
+}
+
+// Writes as much pending output as the socket will take. Returns false once the client is gone.
+bool FlushConnectionOutput(LispServerConnection* conn) {
+	while (conn->outStart < conn->outBuffer.count) {
+		ssize_t writeCount = write(conn->fd, conn->outBuffer.data + conn->outStart, conn->outBuffer.count - conn->outStart);
+		if (writeCount > 0) {
+			conn->outStart += (int)writeCount;
+		}
+		else if (writeCount < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		else if (writeCount < 0 && errno == EINTR) {
+			continue;
+		}
+		else {
+			return false;
+		}
+	}
+
+	DropHandledBytes(&conn->outBuffer, &conn->outStart);
+	return true;
+}
+
+int RunEvalServer(const char* socketPath, LispEvalContext* ctx) {
+	sockaddr_un addr = {};
+	if (StrLen(socketPath) >= (int)sizeof(addr.sun_path)) {
+		printf("Error, socket path is longer than %d characters\n", (int)sizeof(addr.sun_path) - 1);
+		return 1;
+	}
+
+	// A client hanging up mid-response should just drop that connection
+	signal(SIGPIPE, SIG_IGN);
+
+	// The prelude's ports share their file offsets with every request's copy, so keep requests off them
+	ctx->sealedSerial = lispObjectSerial;
+
+	int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd < 0) {
+		perror("socket");
+		return 1;
+	}
+
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, socketPath, StrLen(socketPath) + 1);
+	unlink(socketPath);
+
+	if (bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 64) != 0) {
+		perror("bind/listen");
+		close(listenFd);
+		return 1;
+	}
+
+	printf("Serving on %s\n", socketPath);
+	fflush(stdout);
+
+	Vector<LispServerConnection> conns;
+	Vector<pollfd> pollFds;
+	while (true) {
+		pollFds.Clear();
+		pollfd listenPoll = { listenFd, POLLIN, 0 };
+		pollFds.PushBack(listenPoll);
+		BNS_VEC_FOREACH(conns) {
+			pollfd connPoll = { ptr->fd, (short)(POLLIN | (ptr->outBuffer.count > ptr->outStart ? POLLOUT : 0)), 0 };
+			pollFds.PushBack(connPoll);
+		}
+
+		if (poll(pollFds.data, pollFds.count, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			perror("poll");
+			break;
+		}
+
+		for (int i = conns.count - 1; i >= 0; i--) {
+			short events = pollFds.data[i + 1].revents;
+			bool isOpen = true;
+			if (events & (POLLIN | POLLHUP | POLLERR)) {
+				isOpen = ServiceConnectionInput(&conns.data[i], ctx);
+			}
+
+			if (isOpen && conns.data[i].outBuffer.count > conns.data[i].outStart) {
+				isOpen = FlushConnectionOutput(&conns.data[i]);
+			}
+
+			if (!isOpen) {
+				close(conns.data[i].fd);
+				conns.RemoveRange(i, i + 1);
+			}
+		}
+
+		if (pollFds.data[0].revents & POLLIN) {
+			int connFd = accept(listenFd, nullptr, nullptr);
+			if (connFd >= 0) {
+				fcntl(connFd, F_SETFL, fcntl(connFd, F_GETFL, 0) | O_NONBLOCK);
+				LispServerConnection& conn = conns.EmplaceBack();
+				conn.fd = connFd;
+			}
+		}
+	}
+
+	close(listenFd);
+	unlink(socketPath);
+	return 0;
+}
+
+#endif
+
+// --bench-lists N: times walking an N-element list built one cons at a time (a chunk per cell,
+// as the list-building functions in test.bnl do) against one built as a single chunk by LispValuesToList
+long long SumLispList(const LispValue& list) {
+	long long sum = 0;
+	LispValue cursor = list;
+	while (cursor.IsLispPairValue()) {
+		sum += cursor.AsLispPairValue().Car().AsLispNumValue().iValue;
+		AdvanceLispList(&cursor);
+	}
+	return sum;
+}
+
+double TimeListWalks(const LispValue& list, int passes, long long* outSum) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < passes; i++) {
+		*outSum = SumLispList(list);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+void RunListBenchmark(int elemCount) {
+	// Keep the total work roughly constant, whatever the list length
+	int passes = BNS_MAX(1, 20000000 / BNS_MAX(elemCount, 1));
+
+	Vector<LispValue> elems;
+	elems.EnsureCapacity(elemCount);
+	for (int i = 0; i < elemCount; i++) {
+		elems.EmplaceBack() = MakeLispInt(i);
+	}
+
+	// Cons cells allocated back to back would sit next to each other in memory anyway, unlike a list
+	// built up over time in a busy heap. So first fill a pool of cons-sized chunks, and free every other
+	// one in a random order (the ones kept in between stop the allocator merging the freed ones back
+	// together). The conses below then reuse those addresses, scattered across the pool.
+	Vector<LispValue> pool;
+	pool.EnsureCapacity(elemCount * 2);
+	for (int i = 0; i < elemCount * 2; i++) {
+		LispValue args[2] = { elems.data[i / 2], LispValue() };
+		args[1] = LispBoolValue(false);
+		Builtin_cons(args, 2, &pool.EmplaceBack(), nullptr);
+	}
+
+	Vector<int> freeOrder;
+	freeOrder.EnsureCapacity(elemCount);
+	for (int i = 0; i < elemCount; i++) {
+		freeOrder.PushBack(i * 2 + 1);
+	}
+
+	unsigned int rng = 2463534242u;
+	for (int i = elemCount - 1; i > 0; i--) {
+		rng ^= rng << 13;
+		rng ^= rng >> 17;
+		rng ^= rng << 5;
+		int j = (int)(rng % (unsigned int)(i + 1));
+		int swap = freeOrder.data[i];
+		freeOrder.data[i] = freeOrder.data[j];
+		freeOrder.data[j] = swap;
+	}
+
+	BNS_VEC_FOREACH(freeOrder) {
+		pool.data[*ptr] = LispBoolValue(false);
+	}
+
+	LispValue consList;
+	consList = LispBoolValue(false);
+	for (int i = elemCount - 1; i >= 0; i--) {
+		LispValue args[2] = { elems.data[i], consList };
+		Builtin_cons(args, 2, &consList, nullptr);
+	}
+
+	LispValue chunkList;
+	LispValuesToList(elems.data, elems.count, &chunkList);
+
+	long long consSum = 0, chunkSum = 0;
+	double consTime = TimeListWalks(consList, passes, &consSum);
+	double chunkTime = TimeListWalks(chunkList, passes, &chunkSum);
+	ASSERT(consSum == chunkSum);
+
+	printf("%d elements, %d passes\n", elemCount, passes);
+	printf("  cons-built:   %.3fs (%.2f ns/element)\n", consTime, consTime * 1e9 / ((double)elemCount * passes));
+	printf("  single chunk: %.3fs (%.2f ns/element)\n", chunkTime, chunkTime * 1e9 / ((double)elemCount * passes));
+}
+
 int main(int argc, char** argv){
 	LispEvalContext ctx;
 
+	// Read all the flags first, so the limits apply to every file wherever they appear
+	const char* serveSocketPath = nullptr;
+	Vector<const char*> fileNames;
 	for (int i = 1; i < argc; i++) {
-		String fileContents = ReadStringFromFile(argv[i]);
+		if (StrEqual(argv[i], "--bench-lists")) {
+			ASSERT(i + 1 < argc);
+			RunListBenchmark(atoi(argv[i + 1]));
+			return 0;
+		}
+		else if (StrEqual(argv[i], "--serve")) {
+			ASSERT(i + 1 < argc);
+			serveSocketPath = argv[i + 1];
+			i++;
+			continue;
+		}
+		else if (StrEqual(argv[i], "--max-steps")) {
+			ASSERT(i + 1 < argc);
+			ctx.limits.maxSteps = atoll(argv[i + 1]);
+			i++;
+			continue;
+		}
+		else if (StrEqual(argv[i], "--max-data-bytes")) {
+			ASSERT(i + 1 < argc);
+			ctx.limits.maxDataBytes = atoll(argv[i + 1]);
+			i++;
+			continue;
+		}
+		else if (StrEqual(argv[i], "--max-depth")) {
+			ASSERT(i + 1 < argc);
+			ctx.limits.maxDepth = atoi(argv[i + 1]);
+			i++;
+			continue;
+		}
+		else if (StrEqual(argv[i], "--timeout-ms")) {
+			ASSERT(i + 1 < argc);
+			ctx.limits.timeoutMs = atoi(argv[i + 1]);
+			i++;
+			continue;
+		}
+
+		fileNames.PushBack(argv[i]);
+	}
+
+	BNS_VEC_FOREACH(fileNames) {
+		String fileContents = ReadStringFromFile(*ptr);
 
 		Vector<BNSexpr> sexprs;
 		ParseSexprs(&sexprs, fileContents);
 
 		EvalSexprs(&sexprs, &ctx);
 
-		BNS_VEC_FOREACH(ctx.evalStack) {
-			PrintLispValue(ptr);
-			printf("\n");
-		}
+		PrintEvalResults(&ctx);
+	}
 
-		ctx.evalStack.Clear();
+	if (serveSocketPath != nullptr) {
+#if !defined(_WIN32)
+		return RunEvalServer(serveSocketPath, &ctx);
+#else
+		printf("Error, --serve is not supported on this platform\n");
+		return 1;
+#endif
 	}
 
 	while (true) {
@@ -792,12 +3035,7 @@ int main(int argc, char** argv){
 
 		EvalSexprs(&sexprs, &ctx);
 
-		BNS_VEC_FOREACH(ctx.evalStack) {
-			PrintLispValue(ptr);
-			printf("\n");
-		}
-
-		ctx.evalStack.Clear();
+		PrintEvalResults(&ctx);
 	}
 
 	return 0;